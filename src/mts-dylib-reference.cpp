@@ -6,7 +6,9 @@
  * Released under the MIT license
  */
 
-#include <iostream>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
 #include <cstring>
 #include <cstdint>
 #include <cmath>
@@ -14,6 +16,13 @@
 #include <string>
 #include <cassert>
 #include <mutex>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "mts-dylib-reference.h"
 
 #if !defined(MTSREF_EXPORT)
 #if defined _WIN32 || defined __CYGWIN__
@@ -31,141 +40,2191 @@
 #endif
 #endif
 
-#define LOGDAT                                                                                     \
-    std::cout << "src/mts-dylib-reference.cpp"                                                     \
-              << ":" << __LINE__ << " [" << __func__ << "] "
-#define LOGFN LOGDAT << std::endl;
+/*
+ * Logging. Messages are formatted into a fixed ring of fixed size cells and written out
+ * later by flushLog, which runs from the register / deregister calls and at unload, so
+ * the tuning setters never block on stdout or allocate. If the ring fills up messages
+ * are dropped and counted rather than waiting for space.
+ *
+ * MTSREF_MAX_LOG_LEVEL (the MTS_REFERENCE_MAX_LOG_LEVEL cmake option) removes the more
+ * verbose levels at compile time, and the MTS_REFERENCE_LOG_LEVEL environment variable
+ * picks the level at runtime, defaulting to info.
+ */
+#if !defined(MTSREF_MAX_LOG_LEVEL)
+#define MTSREF_MAX_LOG_LEVEL 4
+#endif
+
+enum LogLevel
+{
+    LOG_NONE = 0,
+    LOG_ERROR = 1,
+    LOG_WARNING = 2,
+    LOG_INFO = 3,
+    LOG_DEBUG = 4
+};
+
+struct LogRing
+{
+    static constexpr size_t numCells{256}; // must be a power of two
+    static constexpr size_t cellSize{256};
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        char message[cellSize];
+    };
+    Cell cells[numCells];
+    std::atomic<size_t> enqueuePos{0};
+    std::atomic<size_t> dequeuePos{0};
+    std::atomic<size_t> dropped{0};
+    std::mutex flushMutex;
+
+    LogRing()
+    {
+        for (size_t i = 0; i < numCells; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ~LogRing() { flush(); }
+
+    int runtimeLevel() const
+    {
+        static const int level = []() {
+            auto e = getenv("MTS_REFERENCE_LOG_LEVEL");
+            return e ? atoi(e) : (int)LOG_INFO;
+        }();
+        return level;
+    }
+
+    void write(int line, const char *func, const char *fmt, ...)
+    {
+        auto pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell *cell{nullptr};
+        for (;;)
+        {
+            cell = &cells[pos & (numCells - 1)];
+            auto seq = cell->sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        auto n = snprintf(cell->message, cellSize, "src/mts-dylib-reference.cpp:%d [%s] ", line,
+                          func);
+        if (n >= 0 && (size_t)n < cellSize)
+        {
+            va_list args;
+            va_start(args, fmt);
+            vsnprintf(cell->message + n, cellSize - n, fmt, args);
+            va_end(args);
+        }
+        cell->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    void flush()
+    {
+        // Only one thread drains; anyone else arriving mid drain just leaves it to them
+        std::unique_lock<std::mutex> lk(flushMutex, std::try_to_lock);
+        if (!lk.owns_lock())
+            return;
+
+        auto pos = dequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto &cell = cells[pos & (numCells - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != pos + 1)
+                break;
+            fputs(cell.message, stdout);
+            fputc('\n', stdout);
+            cell.sequence.store(pos + numCells, std::memory_order_release);
+            pos++;
+        }
+        dequeuePos.store(pos, std::memory_order_relaxed);
+
+        auto d = dropped.exchange(0, std::memory_order_relaxed);
+        if (d)
+            fprintf(stdout, "src/mts-dylib-reference.cpp: %zu log messages dropped\n", d);
+        fflush(stdout);
+    }
+};
+
+LogRing s_log;
+
+#define MTSLOG(lvl, ...)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (MTSREF_MAX_LOG_LEVEL >= lvl && s_log.runtimeLevel() >= lvl)                            \
+            s_log.write(__LINE__, __func__, __VA_ARGS__);                                          \
+    } while (0)
+#define LOGERROR(...) MTSLOG(LOG_ERROR, __VA_ARGS__)
+#define LOGWARN(...) MTSLOG(LOG_WARNING, __VA_ARGS__)
+#define LOGINFO(...) MTSLOG(LOG_INFO, __VA_ARGS__)
+#define LOGDEBUG(...) MTSLOG(LOG_DEBUG, __VA_ARGS__)
+#define LOGFN LOGDEBUG("%s", "");
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <climits>
+#endif
 
 #if IPC_SUPPORT
 #include <sys/shm.h>
-#include <sys/errno.h>
-#include <stdio.h> // for strerror
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <dlfcn.h>
 
-#define LOGERR LOGDAT << " ERROR: " << strerror(errno) << std::endl;
-int shmid{0};
+#define LOGERR LOGERROR("ERROR: %s", strerror(errno));
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define MTSREF_X86_KERNELS 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MTSREF_TARGET_AVX2
+#else
+#define MTSREF_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define MTSREF_X86_KERNELS 0
+#endif
+
+/*
+ * 12-TET frequencies and their reciprocals, generated once rather than with 128 pow
+ * calls on every reset. The arithmetic matches the client shim's, so derived ratios
+ * agree with what it would calculate itself.
+ */
+struct EqualTemperament
+{
+    double freq[128];
+    double inverse[128];
+    EqualTemperament()
+    {
+        for (int i = 0; i < 128; i++)
+        {
+            freq[i] = 440. * pow(2., (i - 69.) / 12.);
+            inverse[i] = 1. / freq[i];
+        }
+    }
+};
+static const EqualTemperament &equalTemperament()
+{
+    static const EqualTemperament t;
+    return t;
+}
+
+/*
+ * Whole table kernels for the master side writes, one set per instruction set and
+ * chosen on first use from what the CPU supports. MTS_REFERENCE_SIMD (scalar, sse2 or
+ * avx2) caps the choice, which is how the tests cover every set on one machine.
+ *
+ * copyTracked copies 128 doubles and sets bit i of changed[i >> 6] wherever dst[i] !=
+ * src[i] beforehand, so a NaN always counts as a change. maskFilter sets each of the 128
+ * filter words to (word & keep) | set and stores the bits that flipped in flipped.
+ */
+struct TableKernels
+{
+    const char *name;
+    void (*copyTracked)(double *dst, const double *src, uint64_t *changed);
+    void (*maskFilter)(uint16_t *filter, uint16_t keep, uint16_t set, uint16_t *flipped);
+};
+
+static void copyTrackedScalar(double *dst, const double *src, uint64_t *changed)
+{
+    changed[0] = changed[1] = 0;
+    for (int i = 0; i < 128; ++i)
+    {
+        changed[i >> 6] |= (uint64_t)(dst[i] != src[i]) << (i & 63);
+        dst[i] = src[i];
+    }
+}
+
+static void maskFilterScalar(uint16_t *filter, uint16_t keep, uint16_t set, uint16_t *flipped)
+{
+    for (int i = 0; i < 128; ++i)
+    {
+        uint16_t b = (filter[i] & keep) | set;
+        flipped[i] = filter[i] ^ b;
+        filter[i] = b;
+    }
+}
+
+#if MTSREF_X86_KERNELS
+static void copyTrackedSSE2(double *dst, const double *src, uint64_t *changed)
+{
+    for (int w = 0; w < 2; ++w, dst += 64, src += 64)
+    {
+        uint64_t m = 0;
+        for (int i = 0; i < 64; i += 2)
+        {
+            auto s = _mm_loadu_pd(src + i);
+            auto ne = _mm_cmpneq_pd(_mm_loadu_pd(dst + i), s);
+            m |= (uint64_t)_mm_movemask_pd(ne) << i;
+            _mm_storeu_pd(dst + i, s);
+        }
+        changed[w] = m;
+    }
+}
+
+static void maskFilterSSE2(uint16_t *filter, uint16_t keep, uint16_t set, uint16_t *flipped)
+{
+    auto k = _mm_set1_epi16((short)keep), st = _mm_set1_epi16((short)set);
+    for (int i = 0; i < 128; i += 8)
+    {
+        auto f = _mm_loadu_si128((const __m128i *)(filter + i));
+        auto b = _mm_or_si128(_mm_and_si128(f, k), st);
+        _mm_storeu_si128((__m128i *)(flipped + i), _mm_xor_si128(f, b));
+        _mm_storeu_si128((__m128i *)(filter + i), b);
+    }
+}
+
+MTSREF_TARGET_AVX2 static void copyTrackedAVX2(double *dst, const double *src, uint64_t *changed)
+{
+    for (int w = 0; w < 2; ++w, dst += 64, src += 64)
+    {
+        uint64_t m = 0;
+        for (int i = 0; i < 64; i += 4)
+        {
+            auto s = _mm256_loadu_pd(src + i);
+            auto ne = _mm256_cmp_pd(_mm256_loadu_pd(dst + i), s, _CMP_NEQ_UQ);
+            m |= (uint64_t)_mm256_movemask_pd(ne) << i;
+            _mm256_storeu_pd(dst + i, s);
+        }
+        changed[w] = m;
+    }
+}
+
+MTSREF_TARGET_AVX2 static void maskFilterAVX2(uint16_t *filter, uint16_t keep, uint16_t set,
+                                              uint16_t *flipped)
+{
+    auto k = _mm256_set1_epi16((short)keep), st = _mm256_set1_epi16((short)set);
+    for (int i = 0; i < 128; i += 16)
+    {
+        auto f = _mm256_loadu_si256((const __m256i *)(filter + i));
+        auto b = _mm256_or_si256(_mm256_and_si256(f, k), st);
+        _mm256_storeu_si256((__m256i *)(flipped + i), _mm256_xor_si256(f, b));
+        _mm256_storeu_si256((__m256i *)(filter + i), b);
+    }
+}
+
+static bool cpuHasAVX2()
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7)
+        return false;
+    __cpuid(r, 1);
+    bool osxsave = r[2] & (1 << 27), avx = r[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) // the OS must save the ymm registers
+        return false;
+    __cpuidex(r, 7, 0);
+    return r[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static const TableKernels &tableKernels()
+{
+    static const TableKernels *chosen = []() {
+        static const TableKernels scalar{"scalar", copyTrackedScalar, maskFilterScalar};
+        const TableKernels *k = &scalar;
+#if MTSREF_X86_KERNELS
+        static const TableKernels sse2{"sse2", copyTrackedSSE2, maskFilterSSE2};
+        static const TableKernels avx2{"avx2", copyTrackedAVX2, maskFilterAVX2};
+        auto e = getenv("MTS_REFERENCE_SIMD");
+        std::string cap = e ? e : "avx2";
+        if (cap != "scalar")
+            k = (cap == "avx2" && cpuHasAVX2()) ? &avx2 : &sse2;
+#endif
+        LOGINFO("Using %s table kernels", k->name);
+        return k;
+    }();
+    return *chosen;
+}
+
+static int lowestSetBit(uint64_t m)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, m);
+    return (int)i;
+#else
+    return __builtin_ctzll(m);
+#endif
+}
+
+/*
+ * Notes and channels arrive as chars from callers we don't control and index the shared
+ * segment, so one bad argument could corrupt every process attached to it. Every export
+ * goes through these. Reads mask notes into 0-127 and use a fallback for an invalid
+ * channel (channel 0, as for an unknown channel), without branching. Setters given an
+ * invalid note or channel do nothing. With MTSREF_TRAP_INVALID_INDEX (the cmake option
+ * MTS_REFERENCE_TRAP_INVALID_INDEX) an argument that had to be masked or refused traps
+ * instead, so the caller can be found in a debugger.
+ */
+#if !defined(MTSREF_TRAP_INVALID_INDEX)
+#define MTSREF_TRAP_INVALID_INDEX 0
+#endif
+
+static inline void checkIndex(bool valid)
+{
+#if MTSREF_TRAP_INVALID_INDEX
+    if (!valid)
+#if defined(_MSC_VER)
+        __debugbreak();
+#else
+        __builtin_trap();
+#endif
+#else
+    (void)valid;
+#endif
+}
+
+static inline bool isValidChannel(char ch) { return (unsigned char)ch < 16; }
+
+static inline int noteIndex(char note)
+{
+    checkIndex((unsigned char)note < 128);
+    return note & 127;
+}
+
+static inline int channelOr(char ch, int fallback)
+{
+    return isValidChannel(ch) ? (unsigned char)ch : fallback;
+}
+
+static bool isValidSetterNote(char note)
+{
+    bool valid = (unsigned char)note < 128;
+    checkIndex(valid);
+    if (!valid)
+        LOGWARN("Ignoring invalid note %d", (int)note);
+    return valid;
+}
+
+static bool isValidSetterChannel(char ch)
+{
+    bool valid = isValidChannel(ch);
+    checkIndex(valid);
+    if (!valid)
+        LOGWARN("Ignoring invalid channel %d", (int)ch);
+    return valid;
+}
+
+static constexpr size_t maxScaleNameSize{512};
+
+#if !defined(MTSREF_TUNING_SLOTS)
+#define MTSREF_TUNING_SLOTS 8
 #endif
+static constexpr int numTuningSlots{MTSREF_TUNING_SLOTS};
+
+static constexpr uint64_t tuningEventCapacity{256};
+
+/*
+ * A channel's tuning in octave-periodic form: offsets in cents from 12-TET for the twelve
+ * pitch classes, repeating every period cents out from the octave starting at middle C.
+ * It is kept beside the channel's table for as long as the table is its expansion, so a
+ * master which thinks in scales can set and read back 13 numbers rather than 128.
+ */
+struct OctaveTuning
+{
+    double cents[12];
+    double period;
+    bool active; // false once the channel's notes have been set some other way
+};
+
+// Everything a master sets, as held by the staging copy and the tuning slots
+struct TuningState
+{
+    double tuning[16][128];
+    OctaveTuning octave[16];
+    uint16_t noteFilter[128];
+    char scaleName[maxScaleNameSize];
+};
+
+/*
+ * The shared segment. Everything a process maps is described by this struct so that
+ * layout changes are a single edit, plus a bump of segmentVersion so that a library
+ * built with a different layout refuses to attach rather than reading garbage.
+ *
+ * Each control field and each per channel table starts on its own cache line. Client
+ * registration churn in clientSlots and master writes to the sequence lock therefore
+ * never invalidate the lines holding the tuning tables every client process reads.
+ */
+static constexpr size_t cacheLineSize{64};
+static constexpr uint32_t segmentMagic{0x5253544d}; // "MTSR"
+static constexpr uint32_t segmentVersion{14};
+
+static constexpr int maxClientProcesses{128};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+                  std::atomic<uint32_t>::is_always_lock_free &&
+                  std::atomic<int32_t>::is_always_lock_free &&
+                  std::atomic<uint64_t>::is_always_lock_free,
+              "Shared segment atomics must be address free");
+
+struct SharedSegment
+{
+    struct alignas(cacheLineSize) Header
+    {
+        std::atomic<uint32_t> magic; // written last, with release, once the segment is set up
+        uint32_t version;
+        uint64_t size;
+    } header;
+
+    /*
+     * The tuning tables, note filter and scale name are guarded by a sequence lock.
+     * A master bumps it to odd before it writes and back to even when it is done, so a
+     * reader which sees the same even value on either side of its copy knows it got a
+     * consistent table. Readers never write the segment and masters never wait on readers.
+     */
+    alignas(cacheLineSize) std::atomic<uint32_t> tuningSequence;
+    uint64_t changeCounter;    // only touched by a writer holding the sequence lock
+    uint64_t lastChangeStamp;  // likewise; the stamp of the last write which changed anything
+    /*
+     * The process holding the write lock, 0 when it is free, and its start time, 0 until
+     * the owner has stored it. A master which dies mid write leaves them set, and the next
+     * writer to find that process gone takes the lock over.
+     */
+    std::atomic<int32_t> tuningWriterPid;
+    std::atomic<uint64_t> tuningWriterStart;
+
+    alignas(cacheLineSize) bool hasMaster;
+    alignas(cacheLineSize) bool tuningInitialized;
+
+    /*
+     * The client registry. Each process with registered clients owns one slot, claimed
+     * by CAS on pid, and counts its clients there. A slot whose process has died is
+     * reaped by whoever next looks at the registry, so a crashed host can neither leak
+     * the segment nor hold the client count up forever. A slot's start time is cleared
+     * before it is freed and reapers skip a slot whose start time is 0, so a slot just
+     * claimed can't be reaped before its new owner has stored its own.
+     */
+    struct alignas(cacheLineSize) ClientSlot
+    {
+        std::atomic<int32_t> pid;        // 0 for a free slot
+        std::atomic<int32_t> count;      // clients registered by that process
+        std::atomic<uint64_t> startTime; // tells the owner from a later process reusing the pid
+        std::atomic<uint64_t> heartbeat; // seconds since epoch of the owner's last registry call
+    } clientSlots[maxClientProcesses];
+    alignas(cacheLineSize) std::atomic<int32_t> overflowClients; // registered with no free slot
+
+    struct alignas(cacheLineSize) ChannelTable
+    {
+        double freq[128];
+    } tuning[16];
+    alignas(cacheLineSize) OctaveTuning octaveTuning[16]; // the form each table was set in, if any
+
+    /*
+     * Tables derived from tuning, recomputed by the writer for the notes it changed just
+     * before it releases the sequence lock. A retune pays for the logs once, rather than
+     * every client process paying for them on every query.
+     */
+    struct alignas(cacheLineSize) DerivedTable
+    {
+        double ratio[128];     // frequency over the 12-TET frequency of the note
+        double semitones[128]; // that ratio in semitones
+        double log2Freq[128];
+    } derived[16];
+
+    // float32 copies of the tuning tables, for single precision DSP; kept with derived
+    struct alignas(cacheLineSize) FloatTable
+    {
+        float freq[128];
+    } tuningFloat[16];
+
+    /*
+     * Frequency to note lookup. Each index holds the distinct unfiltered frequencies in
+     * ascending order, with the lowest channel << 7 | note sounding each one, and the
+     * geometric midpoint up to the next frequency. The nearest note to f is then the
+     * first entry whose bound is above f. channelIndex[16] is for an unknown channel:
+     * channel 0's frequencies, leaving out notes filtered on any channel. Rebuilt by the
+     * writer along with the derived tables.
+     */
+    template <int N> struct alignas(cacheLineSize) NoteIndex
+    {
+        uint32_t count;
+        double freq[N];
+        double bound[N]; // the last is infinite
+        uint16_t key[N];
+    };
+    NoteIndex<128> channelIndex[17];
+    NoteIndex<16 * 128> combinedIndex;
+
+    alignas(cacheLineSize) uint16_t noteFilter[128]; // channel bitset per key
+    /*
+     * noteFilter transposed: bit (note & 63) of filterMask[ch][note >> 6] is set when the
+     * note is filtered on ch. filterMask[16] is notes filtered on any channel, which is
+     * what applies when the channel is unknown. Kept with the derived tables.
+     */
+    alignas(cacheLineSize) uint64_t filterMask[17][2];
+
+    /*
+     * Change generations. Every write stamps the notes whose tuning or filtering it
+     * actually changed with a fresh value of changeCounter, and the channel with the
+     * latest stamp of any of its notes. A client remembers the generation it last
+     * handled and only needs to revisit notes stamped after it.
+     */
+    alignas(cacheLineSize) std::atomic<uint64_t> channelGeneration[16];
+    struct alignas(cacheLineSize) NoteGenerations
+    {
+        uint64_t gen[128];
+    } noteGeneration[16];
+
+    /*
+     * Bumped after every write which changed something, and when a master comes or goes.
+     * It is 32 bits so that waiters can sleep on it with a futex; changeWaiters lets a
+     * master skip the wake syscall when nobody is waiting.
+     */
+    alignas(cacheLineSize) std::atomic<uint32_t> changeNotify;
+    std::atomic<uint32_t> changeWaiters;
+    alignas(cacheLineSize) char scaleName[maxScaleNameSize];
+
+    /*
+     * Preloaded tunings. A master fills slots ahead of time and activating one copies it
+     * into the live tables above, which is what clients read. activeSlot is the slot the
+     * live tables were last activated from, or -1 once anything else has changed them.
+     * Slots are written under the sequence lock like everything else.
+     */
+    alignas(cacheLineSize) std::atomic<int32_t> activeSlot;
+    struct alignas(cacheLineSize) TuningSlot : TuningState
+    {
+    } slots[numTuningSlots];
+
+    /*
+     * Scheduled tuning events, a ring written by the master and read by every client.
+     * Event i lives in cell i % capacity, whose sequence is odd while the master fills
+     * it and 2 * i + 2 once it holds event i, so a reader copies a cell and keeps it only
+     * if the sequence was that value on both sides. The master won't overwrite an event
+     * it hasn't applied yet. Events before eventsDroppedBefore were dropped by
+     * MTS_Reinitialize and are neither read nor applied.
+     */
+    struct TuningEventCell
+    {
+        std::atomic<uint64_t> sequence;
+        uint64_t time;
+        double freq;
+        int8_t note;
+        int8_t channel;
+        bool applied; // only the master reads or writes this
+    };
+    alignas(cacheLineSize) std::atomic<uint64_t> eventHead; // events ever scheduled
+    std::atomic<uint64_t> eventsDroppedBefore;
+    alignas(cacheLineSize) TuningEventCell events[tuningEventCapacity];
+
+    /*
+     * A glide from the tuning at transitionStart towards the live tuning, which has
+     * already been set to the target, over transitionDuration. Times are the master's
+     * clock as for events. Interpolated in log2 frequency; the live side is the derived
+     * log2Freq table. A duration of 0 means no glide.
+     */
+    alignas(cacheLineSize) uint64_t transitionStart;
+    uint64_t transitionDuration;
+    struct alignas(cacheLineSize) TransitionTable
+    {
+        double fromLog2[128];
+    } transitionFrom[16];
+};
+
+static constexpr size_t memSize{sizeof(SharedSegment)};
+
+SharedSegment *segment{nullptr};
+std::atomic<uint32_t> *tuningSequence{nullptr};
+bool *hasMaster{nullptr};
+bool *tuningInitialized{nullptr};
+double *tuning[16]{};
+uint16_t *noteFilter{nullptr}; // channel bitset per key
+char *scaleName;
+
+alignas(SharedSegment) uint8_t memory[memSize];
+
+bool skipIPC()
+{
+    // The environment is read once; this is called from paths which must not hit getenv
+    static const bool skip{getenv("MTS_REFERENCE_DEACTIVATE_IPC") != nullptr};
+    return skip;
+}
+
+struct NoteIndexEntry
+{
+    double freq;
+    uint16_t key; // channel << 7 | note
+    bool operator<(const NoteIndexEntry &o) const
+    {
+        return freq < o.freq || (freq == o.freq && key < o.key);
+    }
+};
+
+/*
+ * Fill idx from entries sorted by frequency then key, keeping the first (lowest key)
+ * of each run of equal frequencies. The midpoint is calculated as the client shim's
+ * linear search does so the two agree on which side of it a frequency falls.
+ *
+ * The pow and log for each bound dominate a rebuild, and a retune usually moves only a
+ * few entries, so the bound of every adjacent pair which was already in idx is kept.
+ */
+static double noteIndexBound(double lo, double hi)
+{
+    static constexpr double ln2{0.693147180559945309417};
+    return lo * pow(2., 0.5 * (log(hi / lo) / ln2));
+}
+
+template <int N>
+static void fillNoteIndex(SharedSegment::NoteIndex<N> &idx, const NoteIndexEntry *e, int n)
+{
+    static double oldFreq[N], oldBound[N]; // only used under the write lock
+    uint32_t oldCount = std::min<uint32_t>(idx.count, N);
+    memcpy(oldFreq, idx.freq, oldCount * sizeof(double));
+    memcpy(oldBound, idx.bound, oldCount * sizeof(double));
+
+    int count = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (count && e[i].freq == idx.freq[count - 1])
+            continue;
+        idx.freq[count] = e[i].freq;
+        idx.key[count] = e[i].key;
+        ++count;
+    }
+    uint32_t j = 0;
+    for (int i = 0; i + 1 < count; ++i)
+    {
+        while (j < oldCount && oldFreq[j] < idx.freq[i])
+            ++j;
+        if (j + 1 < oldCount && oldFreq[j] == idx.freq[i] && oldFreq[j + 1] == idx.freq[i + 1])
+            idx.bound[i] = oldBound[j];
+        else
+            idx.bound[i] = noteIndexBound(idx.freq[i], idx.freq[i + 1]);
+    }
+    if (count)
+        idx.bound[count - 1] = INFINITY;
+    idx.count = count;
+}
+
+static void buildChannelIndex(int ch, int source, uint16_t filterMask)
+{
+    NoteIndexEntry e[128];
+    int n = 0;
+    for (int i = 0; i < 128; ++i)
+    {
+        auto f = tuning[source][i];
+        if (!(noteFilter[i] & filterMask) && !std::isnan(f))
+            e[n++] = {f, (uint16_t)((source << 7) | i)};
+    }
+    // most tunings rise with the note, so are already in order
+    if (!std::is_sorted(e, e + n))
+        std::sort(e, e + n);
+    fillNoteIndex(segment->channelIndex[ch], e, n);
+}
+
+// dst becomes a copy of the channel index src, with the keys moved to keyChannel unless
+// that is negative
+template <int N>
+static void copyNoteIndex(SharedSegment::NoteIndex<N> &dst,
+                          const SharedSegment::NoteIndex<128> &src, int keyChannel)
+{
+    dst.count = src.count;
+    memcpy(dst.freq, src.freq, src.count * sizeof(double));
+    memcpy(dst.bound, src.bound, src.count * sizeof(double));
+    if (keyChannel < 0)
+        memcpy(dst.key, src.key, src.count * sizeof(uint16_t));
+    else
+        for (uint32_t i = 0; i < src.count; ++i)
+            dst.key[i] = (uint16_t)((keyChannel << 7) | (src.key[i] & 127));
+}
+
+/*
+ * Merges the 16 channel indexes, which are already sorted and deduplicated. A channel
+ * sounding the same frequencies as a lower one would lose every entry to it, so is left
+ * out; masters often tune many channels alike.
+ */
+static void buildCombinedIndex()
+{
+    static NoteIndexEntry bufA[16 * 128], bufB[16 * 128]; // only used under the write lock
+    int start[17], n = 0, sources = 0, source = 0;
+    for (int ch = 0; ch < 16; ++ch)
+    {
+        auto &idx = segment->channelIndex[ch];
+        start[ch] = n;
+        bool covered{false};
+        for (int o = 0; o < ch && !covered; ++o)
+            covered = segment->channelIndex[o].count == idx.count &&
+                      memcmp(segment->channelIndex[o].freq, idx.freq,
+                             idx.count * sizeof(double)) == 0;
+        if (covered)
+            continue;
+        sources++;
+        source = ch;
+        for (uint32_t i = 0; i < idx.count; ++i)
+            bufA[n++] = {idx.freq[i], idx.key[i]};
+    }
+    start[16] = n;
+    if (sources == 1)
+    {
+        // every channel sounds the same, or less, so there is nothing to merge
+        copyNoteIndex(segment->combinedIndex, segment->channelIndex[source], -1);
+        return;
+    }
+
+    auto *from = bufA, *to = bufB;
+    for (int width = 1; width < 16; width *= 2)
+    {
+        for (int r = 0; r < 16; r += 2 * width)
+            std::merge(from + start[r], from + start[r + width], from + start[r + width],
+                       from + start[std::min(r + 2 * width, 16)], to + start[r]);
+        std::swap(from, to);
+    }
+    fillNoteIndex(segment->combinedIndex, from, n);
+}
+
+/*
+ * What a channel index held before a write rebuilt it. When it held, and now holds, just
+ * what a lower channel's did, other than the channel in the keys, only alias is set: that
+ * channel.
+ */
+struct ChannelIndexCopy
+{
+    int alias;
+    uint32_t count;
+    double freq[128];
+    uint16_t key[128];
+};
+
+static bool sameNotesAndFrequencies(const SharedSegment::NoteIndex<128> &idx,
+                                    const ChannelIndexCopy &c)
+{
+    if (idx.count != c.count || memcmp(idx.freq, c.freq, c.count * sizeof(double)) != 0)
+        return false;
+    uint16_t diff{0};
+    for (uint32_t i = 0; i < c.count; ++i)
+        diff |= (idx.key[i] ^ c.key[i]) & 127;
+    return diff == 0;
+}
+
+static void removeCombinedEntry(const NoteIndexEntry &e)
+{
+    auto &idx = segment->combinedIndex;
+    uint32_t n = idx.count;
+    uint32_t p = (uint32_t)(std::lower_bound(idx.freq, idx.freq + n, e.freq) - idx.freq);
+    if (p == n || idx.freq[p] != e.freq || idx.key[p] != e.key)
+        return; // a lower key sounds the same frequency, or it has gone already
+
+    // the lowest key still sounding this frequency on any channel takes its place
+    uint32_t key{0xFFFF};
+    for (auto &c : segment->channelIndex)
+    {
+        if (&c == &segment->channelIndex[16])
+            break;
+        auto q = std::lower_bound(c.freq, c.freq + c.count, e.freq) - c.freq;
+        if (q < (ptrdiff_t)c.count && c.freq[q] == e.freq)
+            key = std::min<uint32_t>(key, c.key[q]);
+    }
+    if (key != 0xFFFF)
+    {
+        idx.key[p] = (uint16_t)key;
+        return;
+    }
+
+    memmove(idx.freq + p, idx.freq + p + 1, (n - p - 1) * sizeof(double));
+    memmove(idx.bound + p, idx.bound + p + 1, (n - p - 1) * sizeof(double));
+    memmove(idx.key + p, idx.key + p + 1, (n - p - 1) * sizeof(uint16_t));
+    idx.count = --n;
+    if (p > 0)
+        idx.bound[p - 1] = p < n ? noteIndexBound(idx.freq[p - 1], idx.freq[p]) : INFINITY;
+}
+
+static void addCombinedEntry(const NoteIndexEntry &e)
+{
+    auto &idx = segment->combinedIndex;
+    uint32_t n = idx.count;
+    uint32_t p = (uint32_t)(std::lower_bound(idx.freq, idx.freq + n, e.freq) - idx.freq);
+    if (p < n && idx.freq[p] == e.freq)
+    {
+        idx.key[p] = std::min(idx.key[p], e.key);
+        return;
+    }
+
+    memmove(idx.freq + p + 1, idx.freq + p, (n - p) * sizeof(double));
+    memmove(idx.bound + p + 1, idx.bound + p, (n - p) * sizeof(double));
+    memmove(idx.key + p + 1, idx.key + p, (n - p) * sizeof(uint16_t));
+    idx.count = ++n;
+    idx.freq[p] = e.freq;
+    idx.key[p] = e.key;
+    idx.bound[p] = p + 1 < n ? noteIndexBound(e.freq, idx.freq[p + 1]) : INFINITY;
+    if (p > 0)
+        idx.bound[p - 1] = noteIndexBound(idx.freq[p - 1], e.freq);
+}
+
+/*
+ * Bring the combined index up to date from the entries which left and joined the changed
+ * channels' indexes, rather than merging all 16 again, since a write usually moves only a
+ * few. Entries which left go first, each replaced by the lowest key still sounding its
+ * frequency in the new channel indexes. Returns false, having changed nothing, when too
+ * much moved for that to be worth it.
+ */
+static bool patchCombinedIndex(uint32_t changed, const ChannelIndexCopy *before)
+{
+    static constexpr int maxMoves{64};
+    NoteIndexEntry left[maxMoves], joined[maxMoves];
+    int nl{0}, nj{0};
+    for (uint32_t m = changed; m; m &= m - 1)
+    {
+        int ch = lowestSetBit(m);
+        // a channel which moved just as a lower one did can't hold any entry the lower
+        // one doesn't beat, so its moves change nothing
+        if (before[ch].alias >= 0)
+            continue;
+        auto &o = before[ch];
+        auto &c = segment->channelIndex[ch];
+        // only the stretch between the first and last difference needs walking
+        uint32_t i{0}, j{0}, oEnd{o.count}, cEnd{c.count};
+        while (i < oEnd && i < cEnd && o.freq[i] == c.freq[i] && o.key[i] == c.key[i])
+            ++i;
+        j = i;
+        while (oEnd > i && cEnd > j && o.freq[oEnd - 1] == c.freq[cEnd - 1] &&
+               o.key[oEnd - 1] == c.key[cEnd - 1])
+        {
+            --oEnd;
+            --cEnd;
+        }
+        while (i < oEnd || j < cEnd)
+        {
+            NoteIndexEntry a{i < oEnd ? o.freq[i] : INFINITY, i < oEnd ? o.key[i] : uint16_t{}};
+            NoteIndexEntry b{j < cEnd ? c.freq[j] : INFINITY, j < cEnd ? c.key[j] : uint16_t{}};
+            if (i < oEnd && j < cEnd && a.freq == b.freq && a.key == b.key)
+            {
+                ++i;
+                ++j;
+            }
+            else if (j == cEnd || (i < oEnd && a < b))
+            {
+                if (nl == maxMoves)
+                    return false;
+                left[nl++] = a;
+                ++i;
+            }
+            else
+            {
+                if (nj == maxMoves)
+                    return false;
+                joined[nj++] = b;
+                ++j;
+            }
+        }
+    }
+    for (int i = 0; i < nl; ++i)
+        removeCombinedEntry(left[i]);
+    for (int i = 0; i < nj; ++i)
+        addCombinedEntry(joined[i]);
+    return true;
+}
+
+/*
+ * Bring the derived tables and note indexes up to date for every note stamped by the
+ * write which is finishing. Called with the sequence lock held. rebuild has the combined
+ * index merged again from scratch, rather than patched, for when it can't be trusted.
+ *
+ * Masters often set several channels alike, so a channel whose tuning and filtering
+ * match a channel already brought up to date copies its tables rather than paying for
+ * the logs and the index again.
+ */
+static void updateDerivedTables(uint64_t stamp, bool rebuild)
+{
+    uint32_t changed{0};
+    for (int ch = 0; ch < 16; ++ch)
+        if (segment->channelGeneration[ch].load(std::memory_order_relaxed) == stamp)
+            changed |= 1 << ch;
+    if (!changed)
+        return;
+
+    uint64_t masks[17][2]{};
+    for (int i = 0; i < 128; ++i)
+    {
+        uint64_t bit = 1ULL << (i & 63);
+        for (uint32_t m = noteFilter[i]; m; m &= m - 1)
+            masks[lowestSetBit(m)][i >> 6] |= bit;
+        if (noteFilter[i])
+            masks[16][i >> 6] |= bit;
+    }
+    bool anyFilterChanged = memcmp(segment->filterMask[16], masks[16], sizeof(masks[16])) != 0;
+    memcpy(segment->filterMask, masks, sizeof(masks));
+
+    static constexpr double ratioToSemitones{17.31234049066756088832}; // 12 / log(2)
+    static ChannelIndexCopy before[16]; // only used under the write lock
+    auto iet = equalTemperament().inverse;
+    uint32_t done{0};
+    for (uint32_t m = changed; m; m &= m - 1)
+    {
+        int ch = lowestSetBit(m);
+        int same = -1;
+        for (uint32_t d = done; d && same < 0; d &= d - 1)
+        {
+            int o = lowestSetBit(d);
+            if (memcmp(masks[o], masks[ch], sizeof(masks[ch])) == 0 &&
+                memcmp(tuning[o], tuning[ch], 128 * sizeof(double)) == 0)
+                same = o;
+        }
+        done |= 1 << ch;
+
+        auto &idx = segment->channelIndex[ch];
+        int root = same >= 0 && before[same].alias >= 0 ? before[same].alias : same;
+        before[ch].alias = root >= 0 && sameNotesAndFrequencies(idx, before[root]) ? root : -1;
+        if (before[ch].alias < 0)
+        {
+            before[ch].count = std::min<uint32_t>(idx.count, 128);
+            memcpy(before[ch].freq, idx.freq, before[ch].count * sizeof(double));
+            memcpy(before[ch].key, idx.key, before[ch].count * sizeof(uint16_t));
+        }
+
+        auto &d = segment->derived[ch];
+        auto &gen = segment->noteGeneration[ch].gen;
+        if (same >= 0)
+        {
+            // the notes this write didn't touch already match
+            auto &sd = segment->derived[same];
+            for (int i = 0; i < 128; ++i)
+            {
+                if (gen[i] != stamp)
+                    continue;
+                d.ratio[i] = sd.ratio[i];
+                d.semitones[i] = sd.semitones[i];
+                d.log2Freq[i] = sd.log2Freq[i];
+                segment->tuningFloat[ch].freq[i] = segment->tuningFloat[same].freq[i];
+            }
+            copyNoteIndex(segment->channelIndex[ch], segment->channelIndex[same], ch);
+            continue;
+        }
+
+        for (int i = 0; i < 128; ++i)
+        {
+            if (gen[i] != stamp)
+                continue;
+            d.ratio[i] = tuning[ch][i] * iet[i];
+            d.semitones[i] = ratioToSemitones * log(d.ratio[i]);
+            d.log2Freq[i] = log2(tuning[ch][i]);
+            segment->tuningFloat[ch].freq[i] = (float)tuning[ch][i];
+        }
+        buildChannelIndex(ch, ch, 1 << ch);
+    }
+
+    // channel 0's own index unless another channel filters a note it doesn't
+    if ((changed & 1) || anyFilterChanged)
+    {
+        if (memcmp(masks[16], masks[0], sizeof(masks[0])) == 0)
+            copyNoteIndex(segment->channelIndex[16], segment->channelIndex[0], -1);
+        else
+            buildChannelIndex(16, 0, 0xFFFF);
+    }
+    if (rebuild || !patchCombinedIndex(changed, before))
+        buildCombinedIndex();
+}
+
+static int32_t currentProcessId()
+{
+#if defined(_WIN32)
+    return (int32_t)GetCurrentProcessId();
+#else
+    return (int32_t)getpid();
+#endif
+}
+
+/*
+ * An opaque process start time, used only to compare against itself. 0 if this
+ * platform can't tell us, in which case liveness falls back to the pid alone.
+ */
+static uint64_t processStartTime(int32_t pid)
+{
+#if defined(__linux__)
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    auto f = fopen(path, "r");
+    if (!f)
+        return 0;
+    char buf[1024];
+    auto n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = 0;
+
+    // The command name can contain spaces so count fields from its closing paren.
+    // starttime is field 22, the 20th after it.
+    auto p = strrchr(buf, ')');
+    for (int field = 0; p && field < 20; ++field)
+        p = strchr(p + 1, ' ');
+    return p ? strtoull(p + 1, nullptr, 10) : 0;
+#elif defined(__APPLE__)
+    struct kinfo_proc kp;
+    size_t len = sizeof(kp);
+    int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, pid};
+    if (sysctl(mib, 4, &kp, &len, nullptr, 0) != 0 || len == 0)
+        return 0;
+    return (uint64_t)kp.kp_proc.p_starttime.tv_sec * 1000000 + kp.kp_proc.p_starttime.tv_usec;
+#else
+    return 0;
+#endif
+}
+
+static bool processIsAlive(int32_t pid, uint64_t startTime)
+{
+#if defined(_WIN32)
+    // no IPC on windows so every slot belongs to this process
+    return true;
+#else
+    if (kill(pid, 0) != 0 && errno != EPERM)
+        return false;
+    auto current = processStartTime(pid);
+    return !startTime || !current || current == startTime;
+#endif
+}
+
+static uint64_t secondsSinceEpoch()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+/*
+ * Cached per pid, since a child forked after the library attached inherits the cache and
+ * would otherwise claim its slot with the parent's start time, which other processes then
+ * take as a sign the child has died. Per thread, as writers on any thread ask for it.
+ */
+static uint64_t ownStartTime()
+{
+    thread_local int32_t pid{0};
+    thread_local uint64_t st{0};
+    if (pid != currentProcessId())
+    {
+        pid = currentProcessId();
+        st = processStartTime(pid);
+    }
+    return st;
+}
+
+/*
+ * Wake anything sleeping in MTS_WaitForTuningChange. The counter bump and the waiter
+ * check are sequentially consistent so that either we see a waiter or it sees the bump.
+ */
+static void notifyTuningChange()
+{
+    segment->changeNotify.fetch_add(1);
+    if (segment->changeWaiters.load() == 0)
+        return;
+#if defined(__linux__)
+    // not FUTEX_PRIVATE: the waiters can be in other processes
+    syscall(SYS_futex, &segment->changeNotify, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+/*
+ * Take the write lock over from owner if it died holding it. Returns true if it is now
+ * ours. Two waiters can both find the owner gone but only one wins the CAS.
+ */
+static bool takeOverTuningWriteLock(int32_t owner)
+{
+    if (processIsAlive(owner, segment->tuningWriterStart.load(std::memory_order_relaxed)))
+        return false;
+    if (!segment->tuningWriterPid.compare_exchange_strong(
+            owner, currentProcessId(), std::memory_order_acquire, std::memory_order_relaxed))
+        return false;
+    LOGWARN("Taking over the tuning write lock from exited process %d", (int)owner);
+    return true;
+}
+
+// Tells the CPU this thread is busy-waiting, which saves power and frees a hyperthread
+static inline void cpuRelax()
+{
+#if MTSREF_X86_KERNELS
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Waiting for the write lock. The holder may be rebuilding the derived tables and note
+ * indexes, which takes a while, so after a short spin give the core to it.
+ */
+static void backOff(uint32_t spins)
+{
+    static constexpr uint32_t pauseSpins{64};
+    if (spins < pauseSpins)
+        cpuRelax();
+    else
+        std::this_thread::yield();
+}
+
+/*
+ * Brackets every master side write of the tuning state. Writers claim the lock by CAS
+ * of their pid into tuningWriterPid, so two threads in a master process serialize against
+ * each other here rather than corrupting the sequence, and then move the sequence to odd.
+ *
+ * A waiter checks every so often whether the owner is still alive, which costs a syscall
+ * or two, and takes the lock over from one which isn't. If that writer died mid write the
+ * sequence is already odd and every note is marked changed, so the derived tables are
+ * rebuilt and clients revisit whatever it left half done.
+ */
+struct TuningWriteGuard
+{
+    TuningWriteGuard()
+    {
+        static constexpr uint32_t spinsPerOwnerCheck{4096};
+        auto self = currentProcessId();
+        for (uint32_t spins = 1;; ++spins)
+        {
+            auto owner = segment->tuningWriterPid.load(std::memory_order_relaxed);
+            if (owner == 0 && segment->tuningWriterPid.compare_exchange_weak(
+                                  owner, self, std::memory_order_acquire,
+                                  std::memory_order_relaxed))
+                break;
+            if (owner != 0 && spins % spinsPerOwnerCheck == 0 && takeOverTuningWriteLock(owner))
+                break;
+            backOff(spins);
+        }
+        segment->tuningWriterStart.store(ownStartTime(), std::memory_order_relaxed);
+
+        auto s = tuningSequence->load(std::memory_order_relaxed);
+        bool abandoned = s & 1;
+        if (!abandoned)
+            tuningSequence->store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        stamp = ++segment->changeCounter;
+
+        rebuildIndexes = abandoned;
+        if (abandoned)
+        {
+            segment->lastChangeStamp = stamp;
+            for (int ch = 0; ch < 16; ++ch)
+            {
+                std::fill(segment->noteGeneration[ch].gen, segment->noteGeneration[ch].gen + 128,
+                          stamp);
+                segment->channelGeneration[ch].store(stamp, std::memory_order_relaxed);
+            }
+        }
+    }
+    ~TuningWriteGuard()
+    {
+        bool changed = segment->lastChangeStamp == stamp;
+        if (changed)
+            updateDerivedTables(stamp, rebuildIndexes);
+        tuningSequence->fetch_add(1, std::memory_order_release);
+        segment->tuningWriterStart.store(0, std::memory_order_relaxed);
+        segment->tuningWriterPid.store(0, std::memory_order_release);
+        if (changed)
+            notifyTuningChange();
+    }
+
+    uint64_t stamp; // the generation of every change made under this guard
+    bool rebuildIndexes; // the last writer died, perhaps mid way through the indexes
+};
+
+/*
+ * A master taking over from one which crashed mid write shouldn't wait for its first
+ * write to find the lock stuck, as snapshot reads fail until it is released. An empty
+ * write takes the lock over and releases it.
+ */
+static void recoverTuningWriteLock()
+{
+    auto owner = segment->tuningWriterPid.load(std::memory_order_relaxed);
+    if (owner != 0 &&
+        !processIsAlive(owner, segment->tuningWriterStart.load(std::memory_order_relaxed)))
+        TuningWriteGuard wg;
+}
+
+/*
+ * Every change to a note's tuning or filtering goes through these, inside a
+ * TuningWriteGuard, so the change generations stay in step with the tables. Writing
+ * the value a note already has leaves its generation alone.
+ */
+static void markNoteChanged(int ch, int note, uint64_t stamp)
+{
+    segment->lastChangeStamp = stamp;
+    segment->noteGeneration[ch].gen[note] = stamp;
+    segment->channelGeneration[ch].store(stamp, std::memory_order_relaxed);
+}
+
+static void writeNoteTuning(int ch, int note, double f, uint64_t stamp)
+{
+    if (tuning[ch][note] != f)
+    {
+        tuning[ch][note] = f;
+        markNoteChanged(ch, note, stamp);
+    }
+}
+
+// Marks the notes set in changed[2], as produced by the copyTracked kernel
+static void markNotesChanged(int ch, const uint64_t *changed, uint64_t stamp)
+{
+    if (!(changed[0] | changed[1]))
+        return;
+    segment->lastChangeStamp = stamp;
+    for (int w = 0; w < 2; ++w)
+        for (auto m = changed[w]; m; m &= m - 1)
+            segment->noteGeneration[ch].gen[64 * w + lowestSetBit(m)] = stamp;
+    segment->channelGeneration[ch].store(stamp, std::memory_order_relaxed);
+}
+
+static void writeChannelTuning(int ch, const double *freqs, uint64_t stamp)
+{
+    uint64_t changed[2];
+    tableKernels().copyTracked(tuning[ch], freqs, changed);
+    markNotesChanged(ch, changed, stamp);
+}
+
+static void writeNoteFilter(int note, uint16_t bits, uint64_t stamp)
+{
+    uint16_t changed = noteFilter[note] ^ bits;
+    if (!changed)
+        return;
+
+    noteFilter[note] = bits;
+    for (int ch = 0; ch < 16; ++ch)
+        if (changed & (1 << ch))
+            markNoteChanged(ch, note, stamp);
+}
+
+// Sets every note's filter bits to (bits & keep) | set
+static void writeAllNoteFilters(uint16_t keep, uint16_t set, uint64_t stamp)
+{
+    uint16_t flipped[128];
+    tableKernels().maskFilter(noteFilter, keep, set, flipped);
+    for (int i = 0; i < 128; ++i)
+        for (uint32_t m = flipped[i]; m; m &= m - 1)
+            markNoteChanged(lowestSetBit(m), i, stamp);
+}
+
+static void writeDefaultTuning(uint64_t stamp)
+{
+    for (int ch = 0; ch < 16; ++ch)
+    {
+        writeChannelTuning(ch, equalTemperament().freq, stamp);
+        segment->octaveTuning[ch] = OctaveTuning{{}, 1200., true};
+    }
+    writeAllNoteFilters(0, 0, stamp);
+}
+
+/*
+ * The 128 frequencies an octave tuning stands for. With a 1200 cent period and no offsets
+ * that is exactly equalTemperament(). The last expansion is kept, per thread as staged and
+ * live writers run under different locks, since masters set one tuning on several
+ * channels and flip between a few scales far more often than they invent new ones.
+ */
+static const double *expandOctaveTuning(const OctaveTuning &o)
+{
+    thread_local struct
+    {
+        double cents[12];
+        double period;
+        double freq[128];
+        bool valid;
+    } cache{};
+
+    if (cache.valid && cache.period == o.period &&
+        memcmp(cache.cents, o.cents, sizeof(cache.cents)) == 0)
+        return cache.freq;
+
+    for (int i = 0; i < 128; ++i)
+    {
+        int pc = i % 12;
+        auto cents = 100. * (pc - 9) + o.cents[pc] + (i / 12 - 5) * o.period;
+        cache.freq[i] = 440. * pow(2., cents / 1200.);
+    }
+    memcpy(cache.cents, o.cents, sizeof(cache.cents));
+    cache.period = o.period;
+    cache.valid = true;
+    return cache.freq;
+}
+
+/*
+ * Run copy, which reads the shared tuning state into private memory, retrying if a
+ * master write overlapped it. Gives up after a bounded number of attempts so an audio
+ * thread can never spin behind a master which was descheduled mid write.
+ */
+template <typename F> static bool readConsistently(F &&copy)
+{
+    static constexpr int maxAttempts{64};
+    for (int attempt = 0; attempt < maxAttempts; ++attempt)
+    {
+        if (attempt)
+            cpuRelax();
+        auto before = tuningSequence->load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        copy();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (tuningSequence->load(std::memory_order_relaxed) == before)
+            return true;
+    }
+    return false;
+}
+
+static bool readConsistently(void *out, const void *from, size_t size)
+{
+    return readConsistently([=]() { memcpy(out, from, size); });
+}
+
+/*
+ * Master setters are written once against a tuning writer and run either against the
+ * live segment, each call under its own TuningWriteGuard, or against the staging copy
+ * while an MTS_BeginUpdate is open. Staged changes reach the segment together at
+ * MTS_CommitUpdate, under one guard and so one stamp.
+ */
+struct LiveTuningWriter
+{
+    uint64_t stamp;
+
+    uint16_t filter(int note) const { return noteFilter[note]; }
+    const double *channel(int ch) const { return tuning[ch]; }
+    void setNote(int ch, int note, double f)
+    {
+        writeNoteTuning(ch, note, f, stamp);
+        segment->octaveTuning[ch].active = false;
+    }
+    void setChannel(int ch, const double *freqs)
+    {
+        writeChannelTuning(ch, freqs, stamp);
+        segment->octaveTuning[ch].active = false;
+    }
+    void setOctave(int ch, const OctaveTuning &o)
+    {
+        writeChannelTuning(ch, expandOctaveTuning(o), stamp);
+        segment->octaveTuning[ch] = o;
+        segment->octaveTuning[ch].active = true;
+    }
+    void setFilter(int note, uint16_t bits) { writeNoteFilter(note, bits, stamp); }
+    void setAllFilters(uint16_t keep, uint16_t set) { writeAllNoteFilters(keep, set, stamp); }
+    void setScaleName(const char *s)
+    {
+        if (strncmp(scaleName, s, maxScaleNameSize - 1) != 0)
+            segment->lastChangeStamp = stamp;
+        strncpy(scaleName, s, maxScaleNameSize - 1);
+    }
+};
+
+struct StagedTuning : TuningState
+{
+    uint16_t filter(int note) const { return noteFilter[note]; }
+    const double *channel(int ch) const { return tuning[ch]; }
+    void setNote(int ch, int note, double f)
+    {
+        tuning[ch][note] = f;
+        octave[ch].active = false;
+    }
+    void setChannel(int ch, const double *freqs)
+    {
+        memcpy(tuning[ch], freqs, sizeof(tuning[ch]));
+        octave[ch].active = false;
+    }
+    void setOctave(int ch, const OctaveTuning &o)
+    {
+        memcpy(tuning[ch], expandOctaveTuning(o), sizeof(tuning[ch]));
+        octave[ch] = o;
+        octave[ch].active = true;
+    }
+    void setFilter(int note, uint16_t bits) { noteFilter[note] = bits; }
+    void setAllFilters(uint16_t keep, uint16_t set)
+    {
+        for (auto &f : noteFilter)
+            f = (f & keep) | set;
+    }
+    void setScaleName(const char *s) { strncpy(scaleName, s, maxScaleNameSize - 1); }
+};
+
+static std::mutex s_updateMutex;
+static std::atomic<bool> s_updateOpen{false}; // lets the unstaged path skip the mutex
+static StagedTuning s_staging;                // guarded by s_updateMutex
+
+// Makes the live state equal to st; the live tables no longer come from a slot
+static void publishTuningState(LiveTuningWriter &w, const TuningState &st)
+{
+    for (int ch = 0; ch < 16; ++ch)
+    {
+        if (st.octave[ch].active)
+            w.setOctave(ch, st.octave[ch]);
+        else
+            w.setChannel(ch, st.tuning[ch]);
+    }
+    for (int i = 0; i < 128; ++i)
+        w.setFilter(i, st.noteFilter[i]);
+    w.setScaleName(st.scaleName);
+}
+
+// Called by a writer once it has changed the live state directly
+static void detachFromSlot(const LiveTuningWriter &w)
+{
+    if (segment->lastChangeStamp == w.stamp)
+        segment->activeSlot.store(-1, std::memory_order_relaxed);
+}
+
+template <typename F> static void masterWrite(F &&write)
+{
+    if (s_updateOpen.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> l(s_updateMutex);
+        if (s_updateOpen.load(std::memory_order_relaxed))
+        {
+            write(s_staging);
+            return;
+        }
+    }
+    TuningWriteGuard wg;
+    LiveTuningWriter w{wg.stamp};
+    write(w);
+    detachFromSlot(w);
+}
+
+/*
+ * MIDI Tuning Standard SysEx, decoded for MTS_SetTuningFromSysex into a copy of the 16
+ * channel tables. Messages are split as the client shim's parser splits them: a message
+ * runs from F0 to F7, the next F0 or the end of the buffer, other status bytes inside it
+ * are skipped, a truncated message keeps the entries before the cut and checksums are
+ * not checked. Bulk dump and single note entries are semitones plus 1/16384ths, as the
+ * standard has it, and 7F 7F 7F leaves a note alone. A complete scale/octave message
+ * leaves its channels in octave-periodic form until a later entry retunes them.
+ */
+struct SysexTuningDecoder
+{
+    // the longest message any format reads: a banked single note change of 127 notes
+    static constexpr size_t maxMessageSize{4 + 3 + 127 * 4};
+
+    double tuning[16][128];
+    OctaveTuning octave[16];
+    uint16_t changedChannels{0}, octaveChannels{0};
+    char name[17]{};
+    bool named{false};
+
+    // Returns the number of tuning messages in the buffer
+    int decode(const uint8_t *buffer, int len)
+    {
+        uint8_t message[maxMessageSize];
+        size_t n{0};
+        bool inMessage{false};
+        int found{0};
+        for (int i = 0; i <= len; ++i)
+        {
+            if (i == len || buffer[i] == 0xF0 || buffer[i] == 0xF7)
+            {
+                if (inMessage)
+                    found += decodeMessage(message, n);
+                n = 0;
+                inMessage = i < len && buffer[i] == 0xF0;
+            }
+            else if (buffer[i] < 0x80 && inMessage && n < maxMessageSize)
+            {
+                message[n++] = buffer[i];
+            }
+        }
+        return found;
+    }
+
+  private:
+    void retune(uint16_t channels, int note, double f)
+    {
+        for (int ch = 0; ch < 16; ++ch)
+            if (channels & (1 << ch))
+                tuning[ch][note] = f;
+        changedChannels |= channels;
+        octaveChannels &= ~channels;
+    }
+
+    void entry(int note, const uint8_t *xyz)
+    {
+        if (xyz[0] == 0x7F && xyz[1] == 0x7F && xyz[2] == 0x7F)
+            return;
+        auto semitones = xyz[0] + ((xyz[1] << 7) | xyz[2]) / 16384.;
+        retune(0xFFFF, note, 440. * pow(2., (semitones - 69.) / 12.));
+    }
+
+    bool takeName(const uint8_t *p, size_t n, size_t &i)
+    {
+        if (i + 16 > n)
+            return false;
+        memcpy(name, p + i, 16);
+        named = true;
+        i += 16;
+        return true;
+    }
+
+    // Twelve cents offsets, one or two bytes each, applied to every octave of a pitch class
+    void scaleOctave(uint16_t channels, const uint8_t *p, size_t n, size_t i, bool twoByte)
+    {
+        OctaveTuning o{{}, 1200., true};
+        int pcs = 0;
+        for (; pcs < 12 && i + (twoByte ? 2 : 1) <= n; ++pcs)
+        {
+            if (twoByte)
+            {
+                int v = (p[i] << 7) | p[i + 1];
+                o.cents[pcs] = 100. * (v - 8192.) / (v > 8192 ? 8191. : 8192.);
+                i += 2;
+            }
+            else
+            {
+                o.cents[pcs] = p[i] - 64.;
+                i += 1;
+            }
+        }
+
+        if (pcs < 12)
+        {
+            // cut short, so only the pitch classes which arrived change
+            for (int pc = 0; pc < pcs; ++pc)
+            {
+                auto ratio = pow(2., o.cents[pc] / 1200.);
+                for (int note = pc; note < 128; note += 12)
+                    retune(channels, note, equalTemperament().freq[note] * ratio);
+            }
+            return;
+        }
+        auto freqs = expandOctaveTuning(o);
+        for (int ch = 0; ch < 16; ++ch)
+        {
+            if (channels & (1 << ch))
+            {
+                memcpy(tuning[ch], freqs, sizeof(tuning[ch]));
+                octave[ch] = o;
+            }
+        }
+        changedChannels |= channels;
+        octaveChannels |= channels;
+    }
+
+    // p starts after the F0: universal id, device id, 08, format, then the body
+    bool decodeMessage(const uint8_t *p, size_t n)
+    {
+        if (n < 4 || (p[0] != 0x7E && p[0] != 0x7F) || p[2] != 0x08)
+            return false;
+
+        size_t i = 4;
+        switch (p[3])
+        {
+        case 1: // bulk dump: program, name, 128 entries, checksum
+        case 4: // the same with a bank first
+            i += p[3] == 4 ? 2 : 1;
+            if (takeName(p, n, i))
+                for (int note = 0; note < 128 && i + 3 <= n; ++note, i += 3)
+                    entry(note, p + i);
+            return true;
+        case 2: // single note changes: program, count, then key and entry for each
+        case 7: // the same with a bank first
+        {
+            i += p[3] == 7 ? 2 : 1;
+            int count = i < n ? p[i++] : 0;
+            for (int k = 0; k < count && i + 4 <= n; ++k, i += 4)
+                entry(p[i], p + i + 1);
+            return true;
+        }
+        case 5: // scale/octave dump: bank, program, name, 12 one or two byte values
+        case 6:
+            i += 2;
+            if (takeName(p, n, i))
+                scaleOctave(0xFFFF, p, n, i, p[3] == 6);
+            return true;
+        case 8: // scale/octave tuning: channels 15-16, 8-14 and 1-7 as a bitmap, 12 values
+        case 9:
+            if (n >= 7)
+                scaleOctave((uint16_t)((p[4] & 3) << 14 | p[5] << 7 | p[6]), p, n, 7, p[3] == 9);
+            return true;
+        default: // dump requests and anything unknown
+            return false;
+        }
+    }
+};
+
+static std::mutex s_eventMutex; // serializes this process's use of the event ring
+
+/*
+ * Copy out every event still in the ring which satisfies keep, with the index it was
+ * scheduled at, skipping cells being rewritten underneath us.
+ */
+template <typename F> static int readTuningEvents(MTSTuningEvent *out, uint64_t *index, F &&keep)
+{
+    auto head = segment->eventHead.load(std::memory_order_acquire);
+    auto first = std::max(head > tuningEventCapacity ? head - tuningEventCapacity : 0,
+                          segment->eventsDroppedBefore.load(std::memory_order_acquire));
+    int n = 0;
+    for (auto i = first; i < head; ++i)
+    {
+        auto &cell = segment->events[i % tuningEventCapacity];
+        if (cell.sequence.load(std::memory_order_acquire) != 2 * i + 2)
+            continue;
+        MTSTuningEvent e{cell.time, cell.freq, (char)cell.note, (char)cell.channel};
+        bool applied = cell.applied;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (cell.sequence.load(std::memory_order_relaxed) != 2 * i + 2 || !keep(e, applied))
+            continue;
+        out[n] = e;
+        if (index)
+            index[n] = i;
+        ++n;
+    }
+    return n;
+}
+
+// Order events by time, and by when they were scheduled within the same time
+static void sortTuningEvents(MTSTuningEvent *e, uint64_t *index, int n)
+{
+    for (int i = 1; i < n; ++i)
+        for (int j = i; j > 0 && e[j].time < e[j - 1].time; --j)
+        {
+            std::swap(e[j], e[j - 1]);
+            if (index)
+                std::swap(index[j], index[j - 1]);
+        }
+}
+
+static void cancelUpdate()
+{
+    std::lock_guard<std::mutex> l(s_updateMutex);
+    s_updateOpen.store(false, std::memory_order_release);
+}
+
+// Closes the open update and has publish write the staged state under a single guard
+template <typename F> static bool commitStagedUpdate(F &&publish)
+{
+    std::lock_guard<std::mutex> l(s_updateMutex);
+    if (!s_updateOpen.load(std::memory_order_relaxed))
+    {
+        LOGWARN("Commit without an open update");
+        return false;
+    }
+    s_updateOpen.store(false, std::memory_order_release);
+    if (!hasMaster)
+    {
+        LOGWARN("Warning: Invalid call sequence");
+        return false;
+    }
+
+    TuningWriteGuard wg;
+    LiveTuningWriter w{wg.stamp};
+    return publish(w);
+}
+
+/*
+ * How far through the transition time is, eased with smoothstep so the pitch leaves
+ * and arrives with zero slope. 0 before the start, 1 from the end on.
+ */
+static double transitionWeight(uint64_t start, uint64_t duration, uint64_t time)
+{
+    if (time < start)
+        return 0.;
+    if (time - start >= duration)
+        return 1.;
+    double x = (double)(time - start) / (double)duration;
+    return x * x * (3. - 2. * x);
+}
+
+// Channel ch of the glide at time, into out. Call with the sequence lock held or inside a
+// consistent read.
+static void transitionTable(int ch, uint64_t time, double *out)
+{
+    auto w = transitionWeight(segment->transitionStart, segment->transitionDuration, time);
+    if (w >= 1.)
+    {
+        memcpy(out, tuning[ch], 128 * sizeof(double));
+        return;
+    }
+    auto from = segment->transitionFrom[ch].fromLog2;
+    auto to = segment->derived[ch].log2Freq;
+    for (int i = 0; i < 128; ++i)
+        out[i] = exp2(from[i] + (to[i] - from[i]) * w);
+}
+
+static SharedSegment::ClientSlot *findOwnClientSlot()
+{
+    auto pid = currentProcessId();
+    for (auto &slot : segment->clientSlots)
+        if (slot.pid.load(std::memory_order_acquire) == pid &&
+            slot.startTime.load(std::memory_order_relaxed) == ownStartTime())
+            return &slot;
+    return nullptr;
+}
+
+static SharedSegment::ClientSlot *claimClientSlot()
+{
+    if (auto own = findOwnClientSlot())
+        return own;
+
+    auto pid = currentProcessId();
+    for (auto &slot : segment->clientSlots)
+    {
+        int32_t expected{0};
+        if (slot.pid.compare_exchange_strong(expected, pid, std::memory_order_acq_rel))
+        {
+            slot.startTime.store(ownStartTime(), std::memory_order_release);
+            slot.count.store(0, std::memory_order_relaxed);
+            slot.heartbeat.store(secondsSinceEpoch(), std::memory_order_release);
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+static void reapStaleClientSlots()
+{
+    auto self = currentProcessId();
+    for (auto &slot : segment->clientSlots)
+    {
+        auto pid = slot.pid.load(std::memory_order_acquire);
+        if (pid == 0 || pid == self)
+            continue;
+        // A start time of 0 is a slot being claimed or released. Reading the pid again
+        // makes sure the start time is that pid's and not a new owner's.
+        auto startTime = slot.startTime.load(std::memory_order_acquire);
+        if (startTime == 0 || slot.pid.load(std::memory_order_acquire) != pid ||
+            processIsAlive(pid, startTime))
+            continue;
+
+        // Clearing the start time first picks one reaper when several find the same dead
+        // process. Any other then skips the slot, which keeps the dead pid, and so can't be
+        // claimed, until the winner frees it.
+        if (!slot.startTime.compare_exchange_strong(startTime, 0, std::memory_order_relaxed))
+            continue;
+        LOGINFO("Reaping %d clients of exited process %d, last seen %llus ago",
+                (int)slot.count.load(), (int)pid,
+                (unsigned long long)(secondsSinceEpoch() - slot.heartbeat.load()));
+        slot.count.store(0, std::memory_order_relaxed);
+        slot.pid.compare_exchange_strong(pid, 0, std::memory_order_release,
+                                         std::memory_order_relaxed);
+    }
+}
+
+static int32_t countLiveClients()
+{
+    reapStaleClientSlots();
+
+    int32_t res = segment->overflowClients.load(std::memory_order_relaxed);
+    for (auto &slot : segment->clientSlots)
+        if (slot.pid.load(std::memory_order_acquire) != 0)
+            res += slot.count.load(std::memory_order_relaxed);
+    return res;
+}
+
+std::mutex s_connectMutex{};
+
+/*
+ * Set once this process has laid out its pointers into the segment, and cleared when
+ * the segment is detached. Every export checks it first so that once connected, the
+ * client getters are an acquire load and never touch s_connectMutex.
+ */
+std::atomic<bool> s_connected{false};
+
+#if IPC_SUPPORT
+/*
+ * Check the header of a segment some other process created. The creator publishes the
+ * magic last, so give it a moment if we raced it, then refuse anything whose layout
+ * doesn't match ours.
+ */
+static bool validateSegmentHeader(SharedSegment *seg)
+{
+    auto magic = seg->header.magic.load(std::memory_order_acquire);
+    for (int i = 0; i < 1000 && magic == 0; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        magic = seg->header.magic.load(std::memory_order_acquire);
+    }
+
+    if (magic != segmentMagic)
+    {
+        LOGERROR("Shared memory segment has bad magic %08x; not attaching", magic);
+        return false;
+    }
+    if (seg->header.version != segmentVersion || seg->header.size != memSize)
+    {
+        LOGERROR("Shared memory segment is layout version %u size %llu; this library is "
+                 "version %u size %zu. Not attaching",
+                 seg->header.version, (unsigned long long)seg->header.size, segmentVersion,
+                 memSize);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Pages are faulted in, and optionally locked, as soon as the segment is mapped so the
+ * first read from an audio thread doesn't take a page fault.
+ */
+static void makeResident(void *mem, size_t size)
+{
+#if MTSREF_PREFAULT_SHM
+    auto page = (size_t)sysconf(_SC_PAGESIZE);
+    auto p = (volatile const uint8_t *)mem;
+    for (size_t i = 0; i < size; i += page)
+        (void)p[i];
+#endif
+#if MTSREF_LOCK_SHM
+    if (mlock(mem, size) != 0)
+    {
+        LOGERR;
+        LOGWARN("Unable to lock the shared memory segment into RAM");
+    }
+#endif
+}
+
+/*
+ * System V shared memory, keyed on the path of this library. Segments outlive every
+ * process which attached them until removed, so a crashed host can leave one behind.
+ */
+static int sysvShmId{-1};
+
+static SharedSegment *sysvAttach(bool &created)
+{
+    // We need a shared existing path so
+    Dl_info dl_info;
+    dladdr((void *)sysvAttach, &dl_info);
+    LOGINFO("DLL Path is %s", dl_info.dli_fname);
+
+    key_t key = ftok(dl_info.dli_fname, 63);
+    if (key < 0)
+    {
+        LOGERR;
+        LOGERROR("Unable to create mtsesp / 65 key");
+    }
+
+    // Create the memory exclusively so exactly one process initializes it
+    LOGINFO("shmem Key is %d", (int)key);
+    created = false;
+    sysvShmId = shmget(key, memSize, 0666 | IPC_CREAT | IPC_EXCL);
+    if (sysvShmId >= 0)
+        created = true;
+    else if (errno == EEXIST)
+        sysvShmId = shmget(key, memSize, 0666);
+
+    if (sysvShmId < 0)
+    {
+        LOGERR;
+        LOGERROR("Unable to create or attach shared memory segment of %zu bytes", memSize);
+        return nullptr;
+    }
+
+    auto at = shmat(sysvShmId, (void *)0, 0);
+    if (at == (void *)-1)
+    {
+        LOGERR;
+        LOGERROR("Unable to attach shared memory segment");
+        return nullptr;
+    }
+    return (SharedSegment *)at;
+}
+
+static void sysvDetach(SharedSegment *seg) { shmdt(seg); }
+static void sysvRelease() { shmctl(sysvShmId, IPC_RMID, nullptr); }
+
+/*
+ * POSIX shared memory, named by MTS_REFERENCE_SHM_NAME or /mts-esp-reference. The name
+ * doesn't depend on where the library is installed, and unlinking it on release means
+ * nothing needs ipcrm after a crash beyond the next master or client releasing it.
+ */
+static const char *posixShmName()
+{
+    static const std::string name = []() {
+        auto e = getenv("MTS_REFERENCE_SHM_NAME");
+        std::string n = e ? e : "/mts-esp-reference";
+        return n[0] == '/' ? n : "/" + n;
+    }();
+    return name.c_str();
+}
+
+/*
+ * With MTS_REFERENCE_HUGE_PAGES the segment is sized and mapped in whole 2MB pages and
+ * advised as a transparent huge page candidate, so it sits behind one TLB entry rather
+ * than almost a hundred. That only happens where the kernel allows huge pages for shared
+ * memory (transparent_hugepage/shmem_enabled of advise or within_size); otherwise the
+ * advice is ignored. A segment created without the option is still attached, and still
+ * mapped in 2MB, but is only ever touched within its size.
+ */
+#if MTSREF_HUGE_PAGES && defined(MADV_HUGEPAGE)
+#define MTSREF_ADVISE_HUGE_PAGES 1
+static constexpr size_t hugePageSize{2 * 1024 * 1024};
+static constexpr size_t posixMapSize{(memSize + hugePageSize - 1) / hugePageSize * hugePageSize};
+#else
+static constexpr size_t posixMapSize{memSize};
+#endif
+
+static SharedSegment *posixAttach(bool &created)
+{
+    auto name = posixShmName();
+    LOGINFO("POSIX shm name is %s", name);
+
+    created = false;
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0)
+        {
+            created = true;
+            fchmod(fd, 0666); // not subject to our umask, so other users' hosts can attach
+            if (ftruncate(fd, posixMapSize) != 0)
+            {
+                LOGERR;
+                LOGERROR("Unable to size shared memory segment to %zu bytes", posixMapSize);
+                close(fd);
+                shm_unlink(name);
+                return nullptr;
+            }
+        }
+        else if (errno == EEXIST)
+        {
+            fd = shm_open(name, O_RDWR, 0666);
+        }
+        if (fd < 0)
+        {
+            LOGERR;
+            LOGERROR("Unable to open shared memory segment %s", name);
+            return nullptr;
+        }
+
+        // The creator sizes the segment right after creating it; give it a moment
+        struct stat st{};
+        for (int i = 0; i < 1000 && !created; ++i)
+        {
+            if (fstat(fd, &st) == 0 && st.st_size != 0)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        if (!created && st.st_size == 0)
+        {
+            // whoever created it died before sizing it, so nobody can be using it
+            LOGWARN("Removing abandoned empty shared memory segment %s", name);
+            close(fd);
+            shm_unlink(name);
+            continue;
+        }
+        if (!created && (size_t)st.st_size < memSize)
+        {
+            LOGERROR("Shared memory segment %s is %lld bytes; this library needs %zu. Not "
+                     "attaching",
+                     name, (long long)st.st_size, memSize);
+            close(fd);
+            return nullptr;
+        }
+
+        int flags = MAP_SHARED;
+#if MTSREF_PREFAULT_SHM && defined(MAP_POPULATE) && !MTSREF_ADVISE_HUGE_PAGES
+        // with huge pages makeResident faults the segment in, once the advice is given
+        flags |= MAP_POPULATE;
+#endif
+        auto mem = mmap(nullptr, posixMapSize, PROT_READ | PROT_WRITE, flags, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED)
+        {
+            LOGERR;
+            LOGERROR("Unable to map shared memory segment %s", name);
+            return nullptr;
+        }
+#if MTSREF_ADVISE_HUGE_PAGES
+        if (madvise(mem, posixMapSize, MADV_HUGEPAGE) != 0)
+        {
+            LOGERR;
+            LOGWARN("Unable to ask for huge pages for the shared memory segment");
+        }
+#endif
+        return (SharedSegment *)mem;
+    }
+    return nullptr;
+}
+
+static void posixDetach(SharedSegment *seg) { munmap(seg, posixMapSize); }
+static void posixRelease() { shm_unlink(posixShmName()); }
+
+/*
+ * How a process gets at the shared segment. attach maps the segment, creating it if it
+ * doesn't exist yet and reporting whether it did; detach unmaps it from this process and
+ * release removes it from the system so the next attach starts fresh.
+ *
+ * MTS_REFERENCE_IPC_BACKEND (posix or sysv) overrides the backend picked at build time.
+ * Every process sharing tuning has to use the same one.
+ */
+struct IPCBackend
+{
+    const char *name;
+    SharedSegment *(*attach)(bool &created);
+    void (*detach)(SharedSegment *);
+    void (*release)();
+};
+
+static const IPCBackend &ipcBackend()
+{
+    static const IPCBackend posix{"posix", posixAttach, posixDetach, posixRelease};
+    static const IPCBackend sysv{"sysv", sysvAttach, sysvDetach, sysvRelease};
+    static const IPCBackend &chosen = []() -> const IPCBackend & {
+        auto e = getenv("MTS_REFERENCE_IPC_BACKEND");
+        auto n = e ? e : MTSREF_DEFAULT_IPC_BACKEND;
+        return strcmp(n, "sysv") == 0 ? sysv : posix;
+    }();
+    return chosen;
+}
+#endif
+
+struct DisconnectOnExitGuard
+{
+    ~DisconnectOnExitGuard()
+    {
+        std::lock_guard<std::mutex> cl(s_connectMutex);
+
+#if IPC_SUPPORT
+        if (skipIPC())
+            return;
+
+        if (!hasMaster)
+            return;
 
-static void setDefaultTuning(double *t)
-{
-    for (int i = 0; i < 128; i++)
-        t[i] = 440. * pow(2., (i - 69.) / 12.);
-}
+        /* the difference between this and checkForMemoryRelease is the check
+         * will *also* not detach if it needs to free and this always
+         * detaches since it is an exit guard.
+         */
 
-static constexpr size_t maxScaleNameSize{512};
-static constexpr size_t memSize{sizeof(bool) + sizeof(bool) + sizeof(int32_t) + maxScaleNameSize +
-                                128 * 16 * sizeof(double) + 128 * sizeof(uint16_t)};
-bool *hasMaster{nullptr};
-bool *tuningInitialized{nullptr};
-int32_t *numClients{nullptr};
-double *tuning[16]{};
-uint16_t *noteFilter{nullptr}; // channel bitset per key
-char *scaleName;
+        bool freeSegment{false};
+        if (hasMaster && !*hasMaster && countLiveClients() == 0)
+        {
+            freeSegment = true;
+        }
+        LOGINFO("Detatching shmem on exit");
 
-uint8_t memory[memSize];
+        ipcBackend().detach(segment);
+        hasMaster = nullptr;
+        s_connected.store(false, std::memory_order_release);
 
-bool skipIPC() { return getenv("MTS_REFERENCE_DEACTIVATE_IPC"); }
+        if (freeSegment)
+        {
+            LOGINFO("Deleting shared memory segment with no clients and master");
+            ipcBackend().release();
+        }
+#endif
+    }
+};
 
-std::mutex s_connectMutex{};
 
-bool connectToMemory()
+bool connectToMemorySlow()
 {
     std::lock_guard<std::mutex> cl(s_connectMutex);
 
+    if (s_connected.load(std::memory_order_relaxed)) // another thread won the race
+        return true;
+
     bool initValues{false};
 
-    uint8_t *memSeg{nullptr};
+    SharedSegment *memSeg{nullptr};
 #if IPC_SUPPORT
 
     if (skipIPC())
     {
-        LOGDAT << "IPC-enabled platform chooses to skip IPC support" << std::endl;
-        memSeg = (uint8_t *)(&(memory[0]));
+        LOGINFO("IPC-enabled platform chooses to skip IPC support");
+        memSeg = (SharedSegment *)(&(memory[0]));
     }
     else
     {
-        if (hasMaster && tuningInitialized && numClients &&
-            tuning[0]) // already connected in this process!
-        {
-            return true;
-        }
-
-        // We need a shared existing path so
-        Dl_info dl_info;
-        auto res = dladdr((void *)connectToMemory, &dl_info);
-        LOGDAT << "DLL Path is " << dl_info.dli_fname << std::endl;
+        auto &backend = ipcBackend();
+        LOGINFO("Attaching shared memory with the %s backend", backend.name);
+        memSeg = backend.attach(initValues);
+        if (!memSeg)
+            return false;
+        if (initValues)
+            LOGINFO("Created shared memory segment");
 
-        key_t key = ftok(dl_info.dli_fname, 63);
-        if (key < 0)
-        {
-            LOGERR;
-            LOGDAT << "Unable to create mtsesp / 65 key" << std::endl;
-        }
+        makeResident(memSeg, memSize);
 
-        // Step one: See if they memory exists without creating it
-        LOGDAT << "shmem Key is " << key << std::endl;
-        shmid = shmget(key, memSize, 0666);
-        if (shmid < 0)
+        if (!initValues && !validateSegmentHeader(memSeg))
         {
-            LOGDAT << "Creating and initializing shared memory segment" << std::endl;
-            shmid = shmget(key, memSize, 0666 | IPC_CREAT);
-            initValues = true;
-            if (shmid < 0)
-            {
-                LOGERR;
-                LOGDAT << "Unable to create shared memory segment" << std::endl;
-                return false;
-            }
+            backend.detach(memSeg);
+            return false;
         }
-
-        memSeg = (uint8_t *)shmat(shmid, (void *)0, 0);
     }
 #else
-    memSeg = (uint8_t *)(&(memory[0]));
+    memSeg = (SharedSegment *)(&(memory[0]));
 #endif
 
-    hasMaster = (bool *)memSeg;
-    memSeg += sizeof(bool);
-
-    tuningInitialized = (bool *)memSeg;
-    memSeg += sizeof(bool);
-
-    numClients = (int32_t *)memSeg;
-    memSeg += sizeof(int32_t);
+    // process local memory starts zeroed, so it is initialized on first use
+    if ((uint8_t *)memSeg == &memory[0] && memSeg->header.magic.load() == 0)
+        initValues = true;
 
+    segment = memSeg;
+    tuningSequence = &memSeg->tuningSequence;
+    hasMaster = &memSeg->hasMaster;
+    tuningInitialized = &memSeg->tuningInitialized;
     for (int i = 0; i < 16; ++i)
-    {
-        tuning[i] = (double *)memSeg;
-        memSeg += 128 * sizeof(double);
-    }
-
-    noteFilter = (uint16_t *)memSeg;
-    memSeg += 128 * sizeof(uint16_t);
-
-    scaleName = (char *)memSeg;
-    memSeg += maxScaleNameSize;
+        tuning[i] = memSeg->tuning[i].freq;
+    noteFilter = memSeg->noteFilter;
+    scaleName = memSeg->scaleName;
 
     if (initValues)
     {
-        LOGDAT << "Initializing values post creation" << std::endl;
+        LOGINFO("Initializing values post creation");
+        new (tuningSequence) std::atomic<uint32_t>(0);
+        memSeg->tuningWriterPid.store(0);
+        memSeg->tuningWriterStart.store(0);
         *hasMaster = false;
         *tuningInitialized = false;
-        *numClients = 0;
+        for (auto &slot : memSeg->clientSlots)
+        {
+            slot.pid.store(0);
+            slot.count.store(0);
+            slot.startTime.store(0);
+        }
+        memSeg->overflowClients.store(0);
+        memSeg->activeSlot.store(-1);
+        memSeg->eventHead.store(0);
+        memSeg->eventsDroppedBefore.store(0);
+        memSeg->transitionDuration = 0;
+        for (auto &cell : memSeg->events)
+            cell.sequence.store(0);
     }
 
     if (!*tuningInitialized)
     {
-        LOGDAT << "Initializing tuning table to 12-tet unfiltered" << std::endl;
-        for (int i = 0; i < 16; ++i)
-            setDefaultTuning(tuning[i]);
-        for (int i = 0; i < 128; ++i)
-            noteFilter[i] = 0;
+        LOGINFO("Initializing tuning table to 12-tet unfiltered");
+        TuningWriteGuard wg;
+        writeDefaultTuning(wg.stamp);
         *tuningInitialized = true;
     }
 
+    if (initValues)
+    {
+        memSeg->header.version = segmentVersion;
+        memSeg->header.size = memSize;
+        memSeg->header.magic.store(segmentMagic, std::memory_order_release);
+    }
+
+    static DisconnectOnExitGuard dg;
+    s_connected.store(true, std::memory_order_release);
     return true;
 }
 
+inline bool connectToMemory()
+{
+    if (s_connected.load(std::memory_order_acquire))
+        return true;
+    return connectToMemorySlow();
+}
+
 void checkForMemoryRelease()
 {
     std::lock_guard<std::mutex> cl(s_connectMutex);
@@ -176,66 +2235,31 @@ void checkForMemoryRelease()
 
     if (!hasMaster)
     {
-        LOGDAT << "No need to release when hasMaster not bound to shmem" << std::endl;
+        LOGDEBUG("No need to release when hasMaster not bound to shmem");
         return;
     }
 
     bool freeSegment{false};
-    if (hasMaster && !*hasMaster && numClients && !*numClients)
+    if (hasMaster && !*hasMaster && countLiveClients() == 0)
     {
         freeSegment = true;
     }
 
     if (freeSegment)
     {
-        LOGDAT << "Releasing memory because no clients and no master" << std::endl;
+        LOGINFO("Releasing memory because no clients and no master");
         if (hasMaster)
         {
-            shmdt(hasMaster);
+            ipcBackend().detach(segment);
             hasMaster = nullptr;
+            s_connected.store(false, std::memory_order_release);
         }
-        LOGDAT << "Releasing unused memory segment at " << shmid << std::endl;
-        shmctl(shmid, IPC_RMID, nullptr);
+        LOGINFO("Releasing unused %s memory segment", ipcBackend().name);
+        ipcBackend().release();
     }
 #endif
 }
 
-struct DisconnectOnExitGuard
-{
-    ~DisconnectOnExitGuard()
-    {
-        std::lock_guard<std::mutex> cl(s_connectMutex);
-
-#if IPC_SUPPORT
-        if (skipIPC())
-            return;
-
-        if (!hasMaster)
-            return;
-
-        /* the difference between this and the check above is the check
-         * will *also* not detach if it needs to free and this always
-         * detaches since it is an exit guard.
-         */
-
-        bool freeSegment{false};
-        if (hasMaster && !*hasMaster && numClients && !*numClients)
-        {
-            freeSegment = true;
-        }
-        LOGDAT << "Detatching shmem on exit" << std::endl;
-
-        shmdt(hasMaster);
-        hasMaster = nullptr;
-
-        if (freeSegment)
-        {
-            LOGDAT << "Deleting shared memory segment with no clients and master" << std::endl;
-            shmctl(shmid, IPC_RMID, nullptr);
-        }
-#endif
-    }
-};
 
 extern "C"
 {
@@ -243,7 +2267,7 @@ extern "C"
 #define MASTER_SIDE_VALID(x)                                                                       \
     if (!hasMaster)                                                                                \
     {                                                                                              \
-        LOGDAT << "Warning: Invalid call sequence" << std::endl;                                   \
+        LOGWARN("Warning: Invalid call sequence");                                                 \
         return x;                                                                                  \
     }
 
@@ -253,8 +2277,10 @@ extern "C"
         LOGFN;
         connectToMemory();
         MASTER_SIDE_VALID();
+        recoverTuningWriteLock();
         *hasMaster = true;
-        *numClients = 0;
+        notifyTuningChange();
+        s_log.flush();
     }
     MTSREF_EXPORT void MTS_DeregisterMaster()
     {
@@ -264,9 +2290,11 @@ extern "C"
         if (hasMaster)
         {
             *hasMaster = false;
-            *numClients = 0;
+            notifyTuningChange();
         }
+        cancelUpdate();
         checkForMemoryRelease();
+        s_log.flush();
     }
     MTSREF_EXPORT bool MTS_HasMaster()
     {
@@ -287,83 +2315,151 @@ extern "C"
     MTSREF_EXPORT void MTS_Reinitialize()
     {
         LOGFN;
-        static DisconnectOnExitGuard dg;
-
         connectToMemory();
 
         MASTER_SIDE_VALID();
 
         *hasMaster = false;
-        *numClients = 0;
-        for (int i = 0; i < 16; ++i)
-            setDefaultTuning(tuning[0]);
-        for (int i = 0; i < 128; ++i)
-            noteFilter[i] = 0;
+        cancelUpdate();
+        {
+            // Clients of live processes are real, so only drop the ones a crash left behind
+            std::lock_guard<std::mutex> cl(s_connectMutex);
+            reapStaleClientSlots();
+        }
+
+        // scheduled events are dropped along with everything else. The event lock is
+        // taken before the write lock, as MTS_ApplyDueTuningEvents takes them.
+        std::lock_guard<std::mutex> el(s_eventMutex);
+        segment->eventsDroppedBefore.store(segment->eventHead.load(std::memory_order_relaxed),
+                                           std::memory_order_release);
+
+        TuningWriteGuard wg;
+        writeDefaultTuning(wg.stamp);
+        segment->activeSlot.store(-1, std::memory_order_relaxed);
+        segment->transitionDuration = 0;
 
         *tuningInitialized = true;
+        s_log.flush();
     }
 
     MTSREF_EXPORT int MTS_GetNumClients()
     {
         MASTER_SIDE_VALID(-1);
-        return *numClients;
+        std::lock_guard<std::mutex> cl(s_connectMutex);
+        return countLiveClients();
     }
 
     MTSREF_EXPORT void MTS_SetNoteTunings(const double *d)
     {
         LOGFN;
         MASTER_SIDE_VALID();
-        for (int ch = 0; ch < 16; ++ch)
-            for (int i = 0; i < 128; ++i)
-                tuning[ch][i] = d[i];
+        masterWrite([=](auto &w) {
+            for (int ch = 0; ch < 16; ++ch)
+                w.setChannel(ch, d);
+        });
     }
 
     MTSREF_EXPORT void MTS_SetNoteTuning(double f, char idx)
     {
         MASTER_SIDE_VALID();
-        for (int ch = 0; ch < 16; ++ch)
-            tuning[ch][idx] = f;
+        if (!isValidSetterNote(idx))
+            return;
+        int n = idx;
+        masterWrite([=](auto &w) {
+            for (int ch = 0; ch < 16; ++ch)
+                w.setNote(ch, n, f);
+        });
+    }
+
+    MTSREF_EXPORT int MTS_SetTuningFromSysex(const uint8_t *data, int len)
+    {
+        LOGFN;
+        MASTER_SIDE_VALID(0);
+        if (!data || len <= 0)
+            return 0;
+        int found{0};
+        masterWrite([&](auto &w) {
+            // decode over a copy so each channel is written once, whatever the messages
+            SysexTuningDecoder d;
+            for (int ch = 0; ch < 16; ++ch)
+                memcpy(d.tuning[ch], w.channel(ch), sizeof(d.tuning[ch]));
+            found = d.decode(data, len);
+            for (int ch = 0; ch < 16; ++ch)
+            {
+                if (d.octaveChannels & (1 << ch))
+                    w.setOctave(ch, d.octave[ch]);
+                else if (d.changedChannels & (1 << ch))
+                    w.setChannel(ch, d.tuning[ch]);
+            }
+            if (d.named)
+                w.setScaleName(d.name);
+        });
+        LOGDEBUG("%d tuning messages in %d bytes", found, len);
+        return found;
+    }
+
+    MTSREF_EXPORT bool MTS_SetOctaveTuning(uint16_t channelMask, const double *cents,
+                                           double periodCents)
+    {
+        LOGFN;
+        MASTER_SIDE_VALID(false);
+        if (!cents || !std::isfinite(periodCents) || periodCents <= 0 ||
+            !std::all_of(cents, cents + 12, [](double c) { return std::isfinite(c); }))
+        {
+            LOGWARN("Ignoring invalid octave tuning");
+            return false;
+        }
+        OctaveTuning o{{}, periodCents, true};
+        memcpy(o.cents, cents, sizeof(o.cents));
+        masterWrite([&](auto &w) {
+            for (int ch = 0; ch < 16; ++ch)
+                if (channelMask & (1 << ch))
+                    w.setOctave(ch, o);
+        });
+        return true;
     }
 
     MTSREF_EXPORT void MTS_SetScaleName(const char *s)
     {
         MASTER_SIDE_VALID();
-        LOGDAT << s << std::endl;
-        strncpy(scaleName, s, maxScaleNameSize - 1);
+        LOGDEBUG("%s", s);
+        masterWrite([=](auto &w) { w.setScaleName(s); });
     }
 
     // Don't implement note filtering or channel specific tuning yet
     MTSREF_EXPORT void MTS_FilterNote(bool doF, char note, char chan)
     {
         MASTER_SIDE_VALID();
+        if (!isValidSetterNote(note))
+            return;
+        int n = note;
         uint16_t mask = 0xFFFF;
 
-        if (chan >= 0 && chan <= 15)
+        if (isValidChannel(chan))
         {
             mask = 1 << chan;
         }
 
-        if (doF)
-        {
-            noteFilter[note] = noteFilter[note] | mask;
-        }
-        else
-        {
-            noteFilter[note] = noteFilter[note] & ~mask;
-        }
+        masterWrite([=](auto &w) {
+            if (doF)
+            {
+                w.setFilter(n, w.filter(n) | mask);
+            }
+            else
+            {
+                w.setFilter(n, w.filter(n) & ~mask);
+            }
+        });
     }
     MTSREF_EXPORT void MTS_ClearNoteFilter()
     {
         MASTER_SIDE_VALID();
-        for (int i = 0; i < 128; ++i)
-        {
-            noteFilter[i] = 0;
-        }
+        masterWrite([](auto &w) { w.setAllFilters(0, 0); });
     }
     MTSREF_EXPORT void MTS_FilterNoteMultiChannel(bool doF, char note, char chan)
     {
         MASTER_SIDE_VALID();
-        if (chan >= 0 && chan < 15)
+        if (isValidSetterChannel(chan))
         {
             MTS_FilterNote(doF, note, chan);
         }
@@ -371,72 +2467,522 @@ extern "C"
     MTSREF_EXPORT void MTS_ClearNoteFilterMultiChannel(char chan)
     {
         MASTER_SIDE_VALID();
+        if (!isValidSetterChannel(chan))
+            return;
         uint16_t off = 1 << chan;
-        for (int i = 0; i < 128; ++i)
-        {
-            noteFilter[i] = noteFilter[i] & ~off;
-        }
+        masterWrite([=](auto &w) { w.setAllFilters((uint16_t)~off, 0); });
     }
 
     MTSREF_EXPORT void MTS_SetMultiChannel(bool, char) {}
     MTSREF_EXPORT void MTS_SetMultiChannelNoteTunings(const double *d, char ch)
     {
         MASTER_SIDE_VALID();
-        for (int i = 0; i < 128; ++i)
-            tuning[ch][i] = d[i];
+        if (!isValidSetterChannel(ch))
+            return;
+        masterWrite([=](auto &w) { w.setChannel(ch, d); });
     }
     MTSREF_EXPORT void MTS_SetMultiChannelNoteTuning(double freq, char note, char ch)
     {
         MASTER_SIDE_VALID();
-        LOGDAT << "f=" << freq << " at " << (int)note << " " << (int)ch << std::endl;
-        tuning[ch][note] = freq;
+        LOGDEBUG("f=%f at %d %d", freq, (int)note, (int)ch);
+        if (!isValidSetterChannel(ch) || !isValidSetterNote(note))
+            return;
+        masterWrite([=](auto &w) { w.setNote(ch, note, freq); });
+    }
+    MTSREF_EXPORT bool MTS_BeginUpdate()
+    {
+        LOGFN;
+        MASTER_SIDE_VALID(false);
+        std::lock_guard<std::mutex> l(s_updateMutex);
+        if (s_updateOpen.load(std::memory_order_relaxed))
+        {
+            LOGWARN("An update is already open");
+            return false;
+        }
+
+        // start from the live state so setters which read it, like FilterNote, see it
+        if (!readConsistently([]() {
+                memcpy(s_staging.tuning, tuning[0], sizeof(s_staging.tuning));
+                memcpy(s_staging.octave, segment->octaveTuning, sizeof(s_staging.octave));
+                memcpy(s_staging.noteFilter, noteFilter, sizeof(s_staging.noteFilter));
+                memcpy(s_staging.scaleName, scaleName, sizeof(s_staging.scaleName));
+            }))
+            return false;
+        s_staging.scaleName[maxScaleNameSize - 1] = 0;
+
+        s_updateOpen.store(true, std::memory_order_release);
+        return true;
+    }
+    MTSREF_EXPORT bool MTS_CommitUpdateToSlot(int slot)
+    {
+        LOGFN;
+        // checked first so that a bad slot leaves the update open
+        if (slot < -1 || slot >= numTuningSlots)
+        {
+            LOGWARN("No tuning slot %d", slot);
+            return false;
+        }
+        return commitStagedUpdate([slot](LiveTuningWriter &w) {
+            if (slot >= 0)
+            {
+                memcpy((TuningState *)&segment->slots[slot], (const TuningState *)&s_staging,
+                       sizeof(TuningState));
+                // refilling the active slot changes what is playing
+                if (segment->activeSlot.load(std::memory_order_relaxed) == slot)
+                    publishTuningState(w, s_staging);
+            }
+            else
+            {
+                publishTuningState(w, s_staging);
+                detachFromSlot(w);
+            }
+            return true;
+        });
+    }
+    MTSREF_EXPORT bool MTS_CommitUpdateWithTransition(uint64_t startTime, uint64_t duration)
+    {
+        LOGFN;
+        return commitStagedUpdate([=](LiveTuningWriter &w) {
+            // Glide from wherever the previous glide has got to at startTime, so
+            // retargeting mid glide doesn't jump
+            for (int ch = 0; ch < 16; ++ch)
+            {
+                double at[128];
+                transitionTable(ch, startTime, at);
+                for (int i = 0; i < 128; ++i)
+                    segment->transitionFrom[ch].fromLog2[i] = log2(at[i]);
+            }
+            segment->transitionStart = startTime;
+            segment->transitionDuration = duration;
+            publishTuningState(w, s_staging);
+            detachFromSlot(w);
+            return true;
+        });
+    }
+    MTSREF_EXPORT bool MTS_CommitUpdate()
+    {
+        LOGFN;
+        return MTS_CommitUpdateToSlot(-1);
+    }
+    MTSREF_EXPORT bool MTS_ScheduleNoteTuning(double freq, char note, char ch, uint64_t time)
+    {
+        MASTER_SIDE_VALID(false);
+        if (!isValidSetterNote(note))
+            return false;
+        std::lock_guard<std::mutex> el(s_eventMutex);
+
+        auto i = segment->eventHead.load(std::memory_order_relaxed);
+        auto &cell = segment->events[i % tuningEventCapacity];
+        auto dropped = segment->eventsDroppedBefore.load(std::memory_order_relaxed);
+        if (i >= tuningEventCapacity && i - tuningEventCapacity >= dropped && !cell.applied)
+        {
+            LOGWARN("Tuning event ring is full");
+            return false;
+        }
+
+        cell.sequence.store(2 * i + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        cell.time = time;
+        cell.freq = freq;
+        cell.note = note;
+        cell.channel = channelOr(ch, -1);
+        cell.applied = false;
+        cell.sequence.store(2 * i + 2, std::memory_order_release);
+        segment->eventHead.store(i + 1, std::memory_order_release);
+        return true;
+    }
+    MTSREF_EXPORT int MTS_ApplyDueTuningEvents(uint64_t now)
+    {
+        MASTER_SIDE_VALID(0);
+        std::lock_guard<std::mutex> el(s_eventMutex);
+
+        MTSTuningEvent due[tuningEventCapacity];
+        uint64_t index[tuningEventCapacity];
+        int n = readTuningEvents(due, index, [now](const MTSTuningEvent &e, bool applied) {
+            return !applied && e.time <= now;
+        });
+        if (!n)
+            return 0;
+        sortTuningEvents(due, index, n);
+
+        auto apply = [&](auto &w) {
+            for (int i = 0; i < n; ++i)
+            {
+                if (due[i].midichannel >= 0)
+                    w.setNote(due[i].midichannel, due[i].midinote, due[i].freq);
+                else
+                    for (int ch = 0; ch < 16; ++ch)
+                        w.setNote(ch, due[i].midinote, due[i].freq);
+            }
+        };
+        {
+            // Due events sound now even while an update is open, and the update gets them
+            // too so that committing it doesn't take them back
+            std::lock_guard<std::mutex> l(s_updateMutex);
+            if (s_updateOpen.load(std::memory_order_relaxed))
+                apply(s_staging);
+            TuningWriteGuard wg;
+            LiveTuningWriter w{wg.stamp};
+            apply(w);
+            detachFromSlot(w);
+        }
+        for (int i = 0; i < n; ++i)
+            segment->events[index[i] % tuningEventCapacity].applied = true;
+        return n;
+    }
+    MTSREF_EXPORT bool MTS_ActivateSlot(int slot)
+    {
+        LOGFN;
+        MASTER_SIDE_VALID(false);
+        if (slot < 0 || slot >= numTuningSlots)
+        {
+            LOGWARN("No tuning slot %d", slot);
+            return false;
+        }
+
+        // committing an update begun before would publish its copy over the slot
+        std::lock_guard<std::mutex> l(s_updateMutex);
+        if (s_updateOpen.load(std::memory_order_relaxed))
+        {
+            LOGWARN("Can't activate slot %d while an update is open", slot);
+            return false;
+        }
+        TuningWriteGuard wg;
+        LiveTuningWriter w{wg.stamp};
+        segment->activeSlot.store(slot, std::memory_order_relaxed);
+        publishTuningState(w, segment->slots[slot]);
+        return true;
+    }
+    MTSREF_EXPORT void MTS_CancelUpdate()
+    {
+        LOGFN;
+        cancelUpdate();
     }
 
     // Client implementation
     MTSREF_EXPORT void MTS_RegisterClient()
     {
-        connectToMemory();
-        (*numClients)++;
-        LOGDAT << "Client count is " << (*numClients) << std::endl;
+        if (!connectToMemory())
+            return;
+        {
+            std::lock_guard<std::mutex> cl(s_connectMutex);
+            if (auto slot = claimClientSlot())
+            {
+                slot->count.fetch_add(1, std::memory_order_relaxed);
+                slot->heartbeat.store(secondsSinceEpoch(), std::memory_order_relaxed);
+            }
+            else
+            {
+                LOGWARN("Client registry is full; counting client without a process slot");
+                segment->overflowClients.fetch_add(1, std::memory_order_relaxed);
+            }
+            LOGINFO("Client count is %d", (int)countLiveClients());
+        }
+        s_log.flush();
     }
     MTSREF_EXPORT void MTS_DeregisterClient()
     {
-        (*numClients)--;
-        LOGDAT << "Client count is " << (*numClients) << std::endl;
+        if (!hasMaster)
+            return;
+        {
+            std::lock_guard<std::mutex> cl(s_connectMutex);
+            auto slot = findOwnClientSlot();
+            if (slot && slot->count.load(std::memory_order_relaxed) > 0)
+            {
+                slot->heartbeat.store(secondsSinceEpoch(), std::memory_order_relaxed);
+                if (slot->count.fetch_sub(1, std::memory_order_relaxed) == 1)
+                {
+                    slot->startTime.store(0, std::memory_order_relaxed);
+                    slot->pid.store(0, std::memory_order_release);
+                }
+            }
+            else if (segment->overflowClients.load(std::memory_order_relaxed) > 0)
+            {
+                segment->overflowClients.fetch_sub(1, std::memory_order_relaxed);
+            }
+            LOGINFO("Client count is %d", (int)countLiveClients());
+        }
         checkForMemoryRelease();
+        s_log.flush();
     }
 
     MTSREF_EXPORT bool MTS_ShouldFilterNote(char note, char chan)
     {
         uint16_t mask = 0xFFFF;
-        if (chan >= 0 && chan <= 15)
+        if (isValidChannel(chan))
             mask = 1 << chan;
 
-        return noteFilter[note] & mask;
+        return noteFilter[noteIndex(note)] & mask;
     }
 
     MTSREF_EXPORT bool MTS_ShouldFilterNoteMultiChannel(char note, char chan)
     {
         uint16_t mask = 0xFFFF;
-        if (chan >= 0 && chan <= 15)
+        if (isValidChannel(chan))
             mask = 1 << chan;
 
-        return noteFilter[note] & mask;
+        return noteFilter[noteIndex(note)] & mask;
+    }
+
+    MTSREF_EXPORT bool MTS_GetNoteFilterMask(char ch, uint64_t *mask)
+    {
+        if (!connectToMemory())
+            return false;
+        return readConsistently(mask, segment->filterMask[channelOr(ch, 16)],
+                                2 * sizeof(uint64_t));
+    }
+    MTSREF_EXPORT bool MTS_GetNoteFilterBitmap(uint64_t *bitmap)
+    {
+        if (!connectToMemory())
+            return false;
+        return readConsistently(bitmap, segment->filterMask, 16 * 2 * sizeof(uint64_t));
     }
 
     MTSREF_EXPORT const double *MTS_GetTuningTable()
     {
-        static DisconnectOnExitGuard rt;
         connectToMemory();
 
-        return &tuning[0][0];
+        return tuning[0];
     }
     MTSREF_EXPORT const double *MTS_GetMultiChannelTuningTable(char ch)
     {
-        static DisconnectOnExitGuard rt;
         connectToMemory();
 
-        return &tuning[ch][0];
+        checkIndex(isValidChannel(ch));
+        return tuning[channelOr(ch, 0)];
+    }
+    MTSREF_EXPORT bool MTS_GetTuningTableSnapshot(double *out)
+    {
+        return MTS_GetMultiChannelTuningTableSnapshot(out, 0);
+    }
+    MTSREF_EXPORT bool MTS_GetMultiChannelTuningTableSnapshot(double *out, char ch)
+    {
+        if (!connectToMemory())
+            return false;
+
+        return readConsistently(out, tuning[channelOr(ch, 0)], 128 * sizeof(double));
+    }
+    MTSREF_EXPORT bool MTS_GetAllChannelsTuningTableSnapshot(double *out)
+    {
+        if (!connectToMemory())
+            return false;
+
+        // the channel tables are cache line multiples so they are contiguous in the segment
+        static_assert(sizeof(SharedSegment::ChannelTable) == 128 * sizeof(double));
+        return readConsistently(out, tuning[0], 16 * 128 * sizeof(double));
+    }
+    MTSREF_EXPORT const float *MTS_GetTuningTableFloat()
+    {
+        if (!connectToMemory())
+            return nullptr;
+        return segment->tuningFloat[0].freq;
+    }
+    MTSREF_EXPORT const float *MTS_GetMultiChannelTuningTableFloat(char ch)
+    {
+        if (!connectToMemory())
+            return nullptr;
+        return segment->tuningFloat[channelOr(ch, 0)].freq;
+    }
+    MTSREF_EXPORT bool MTS_GetMultiChannelTuningTableSnapshotFloat(float *out, char ch)
+    {
+        if (!connectToMemory())
+            return false;
+        return readConsistently(out, segment->tuningFloat[channelOr(ch, 0)].freq, 128 * sizeof(float));
+    }
+    MTSREF_EXPORT const double *MTS_GetRatioTable(char ch)
+    {
+        if (!connectToMemory())
+            return nullptr;
+        return segment->derived[channelOr(ch, 0)].ratio;
+    }
+    MTSREF_EXPORT const double *MTS_GetSemitoneTable(char ch)
+    {
+        if (!connectToMemory())
+            return nullptr;
+        return segment->derived[channelOr(ch, 0)].semitones;
+    }
+    MTSREF_EXPORT const double *MTS_GetLog2FrequencyTable(char ch)
+    {
+        if (!connectToMemory())
+            return nullptr;
+        return segment->derived[channelOr(ch, 0)].log2Freq;
+    }
+    MTSREF_EXPORT char MTS_FindNearestNote(double freq, char ch)
+    {
+        if (!connectToMemory())
+            return 0;
+
+        auto &idx = segment->channelIndex[channelOr(ch, 16)];
+        uint16_t key{0};
+        // a torn read can only pick a wrong note, so after the retries take what we got
+        readConsistently([&]() {
+            auto n = std::min(idx.count, (uint32_t)128);
+            auto k = std::upper_bound(idx.bound, idx.bound + n, freq) - idx.bound;
+            key = n ? idx.key[std::min(k, (ptrdiff_t)n - 1)] : 0;
+        });
+        return key & 127;
+    }
+    MTSREF_EXPORT char MTS_FindNearestNoteAndChannel(double freq, char *midichannel)
+    {
+        *midichannel = 0;
+        if (!connectToMemory())
+            return 0;
+
+        auto &idx = segment->combinedIndex;
+        uint16_t key{0};
+        readConsistently([&]() {
+            auto n = std::min(idx.count, (uint32_t)(16 * 128));
+            auto k = std::upper_bound(idx.bound, idx.bound + n, freq) - idx.bound;
+            key = n ? idx.key[std::min(k, (ptrdiff_t)n - 1)] : 0;
+        });
+        *midichannel = (key >> 7) & 15;
+        return key & 127;
+    }
+    MTSREF_EXPORT uint64_t MTS_GetMonotonicTimeNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+    MTSREF_EXPORT int MTS_GetTuningEvents(uint64_t from, uint64_t to, MTSTuningEvent *out, int max)
+    {
+        if (max <= 0 || !connectToMemory())
+            return 0;
+
+        MTSTuningEvent found[tuningEventCapacity];
+        int n = readTuningEvents(found, nullptr, [=](const MTSTuningEvent &e, bool) {
+            return e.time >= from && e.time < to;
+        });
+        sortTuningEvents(found, nullptr, n);
+        n = std::min(n, max);
+        std::copy(found, found + n, out);
+        return n;
+    }
+    MTSREF_EXPORT bool MTS_GetTransitionTuningTable(double *out, char ch, uint64_t time)
+    {
+        if (!connectToMemory())
+            return false;
+        int c = channelOr(ch, 0);
+        return readConsistently([&]() { transitionTable(c, time, out); });
+    }
+    MTSREF_EXPORT double MTS_GetTransitionFrequency(char note, char ch, uint64_t time)
+    {
+        if (!connectToMemory())
+            return 0;
+        int c = channelOr(ch, 0), n = noteIndex(note);
+        double f{0};
+        // a torn read gives a wrong value, not a crash, so after the retries use it
+        readConsistently([&]() {
+            auto w = transitionWeight(segment->transitionStart, segment->transitionDuration, time);
+            auto from = segment->transitionFrom[c].fromLog2[n];
+            f = w >= 1. ? tuning[c][n] : exp2(from + (segment->derived[c].log2Freq[n] - from) * w);
+        });
+        return f;
+    }
+    MTSREF_EXPORT bool MTS_GetOctaveTuning(char ch, double *cents, double *periodCents)
+    {
+        if (!connectToMemory())
+            return false;
+        OctaveTuning o;
+        if (!readConsistently(&o, &segment->octaveTuning[channelOr(ch, 0)], sizeof(o)) ||
+            !o.active)
+            return false;
+        memcpy(cents, o.cents, sizeof(o.cents));
+        *periodCents = o.period;
+        return true;
+    }
+    MTSREF_EXPORT int MTS_GetNumTuningSlots() { return numTuningSlots; }
+    MTSREF_EXPORT int MTS_GetActiveSlot()
+    {
+        if (!connectToMemory())
+            return -1;
+        return segment->activeSlot.load(std::memory_order_acquire);
+    }
+    MTSREF_EXPORT bool MTS_GetSlotTuningTableSnapshot(int slot, double *out, char ch)
+    {
+        if (slot < 0 || slot >= numTuningSlots || !connectToMemory())
+            return false;
+        return readConsistently(out, segment->slots[slot].tuning[channelOr(ch, 0)], 128 * sizeof(double));
+    }
+    MTSREF_EXPORT bool MTS_GetSlotName(int slot, char *out, int size)
+    {
+        if (slot < 0 || slot >= numTuningSlots || size <= 0 || !connectToMemory())
+            return false;
+        auto &name = segment->slots[slot].scaleName;
+        auto n = std::min((size_t)size - 1, sizeof(name) - 1);
+        if (!readConsistently(out, name, n))
+            return false;
+        out[n] = 0;
+        return true;
+    }
+    MTSREF_EXPORT uint64_t MTS_GetTuningGeneration(char ch)
+    {
+        if (!connectToMemory())
+            return 0;
+
+        // Clients which don't know their channel read channel 0's table
+        int c = channelOr(ch, 0);
+        return segment->channelGeneration[c].load(std::memory_order_acquire);
+    }
+    MTSREF_EXPORT uint64_t MTS_GetDirtyNotes(char ch, uint64_t sinceGeneration, uint64_t *mask)
+    {
+        mask[0] = mask[1] = ~0ULL;
+        if (!connectToMemory())
+            return sinceGeneration;
+
+        int c = channelOr(ch, 0);
+        uint64_t gens[128], current{0};
+        if (!readConsistently([&]() {
+                current = segment->channelGeneration[c].load(std::memory_order_relaxed);
+                memcpy(gens, segment->noteGeneration[c].gen, sizeof(gens));
+            }))
+        {
+            // report everything dirty and let the caller ask again from the same place
+            return sinceGeneration;
+        }
+
+        mask[0] = mask[1] = 0;
+        for (int i = 0; i < 128; ++i)
+            mask[i >> 6] |= (uint64_t)(gens[i] > sinceGeneration) << (i & 63);
+        return current;
+    }
+    MTSREF_EXPORT uint32_t MTS_GetTuningChangeCount()
+    {
+        if (!connectToMemory())
+            return 0;
+        return segment->changeNotify.load(std::memory_order_acquire);
+    }
+    MTSREF_EXPORT uint32_t MTS_WaitForTuningChange(uint32_t sinceChangeCount, int timeoutMs)
+    {
+        if (!connectToMemory())
+            return sinceChangeCount;
+
+        auto &notify = segment->changeNotify;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+        segment->changeWaiters.fetch_add(1);
+        uint32_t current;
+        while ((current = notify.load()) == sinceChangeCount)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (timeoutMs >= 0 && remaining.count() <= 0)
+                break;
+#if defined(__linux__)
+            // Sleeps only if the word still holds sinceChangeCount, so a bump between the
+            // load above and here can't be missed. Spurious and EINTR wakes just loop.
+            struct timespec ts;
+            ts.tv_sec = remaining.count() / 1000000000;
+            ts.tv_nsec = remaining.count() % 1000000000;
+            syscall(SYS_futex, &notify, FUTEX_WAIT, sinceChangeCount,
+                    timeoutMs >= 0 ? &ts : nullptr, nullptr, 0);
+#else
+            // No cross process wait primitive we can rely on here, so poll
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+        }
+        segment->changeWaiters.fetch_sub(1);
+        return current;
     }
     MTSREF_EXPORT bool MTS_UseMultiChannelTuning(char) { return true; }
     MTSREF_EXPORT const char *MTS_GetScaleName() {
@@ -0,0 +1,246 @@
+/*
+ * An implementation of the MTS-ESP middleware dylib.
+ *
+ * For more information, see oddsound.com
+ *
+ * Released under the MIT license
+ */
+
+#ifndef MTS_DYLIB_REFERENCE_H
+#define MTS_DYLIB_REFERENCE_H
+
+/*
+ * Extensions to the MTS-ESP middleware API which this reference library exports
+ * in addition to the functions the ODDSound client and master shims resolve.
+ *
+ * None of these are part of the ODDSound API. Resolve them with dlsym / GetProcAddress
+ * and treat a missing symbol as "not supported by this library".
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+     * Consistent snapshots of the tuning tables. The pointers returned by
+     * MTS_GetTuningTable and MTS_GetMultiChannelTuningTable are read while a master
+     * may be rewriting them, so a reader can observe a partially applied retune.
+     * These calls copy the table under the library's sequence lock and never block
+     * a master. They return false if a consistent copy could not be taken within a
+     * bounded number of attempts, in which case the contents of out are unspecified
+     * and the caller should keep using its previous copy.
+     *
+     * out must hold 128 doubles for the single channel calls and 16 * 128 doubles,
+     * channel major, for the all channel call.
+     */
+    bool MTS_GetTuningTableSnapshot(double *out);
+    bool MTS_GetMultiChannelTuningTableSnapshot(double *out, char midichannel);
+    bool MTS_GetAllChannelsTuningTableSnapshot(double *out);
+
+    /*
+     * Grouped master updates. Between MTS_BeginUpdate and MTS_CommitUpdate the master
+     * setters (note tunings, filters and the scale name) change a private copy of the
+     * tuning state instead of the shared one. MTS_CommitUpdate publishes the whole copy
+     * as one write: clients see all of it or none of it, every note it changed gets the
+     * same generation, and waiters are woken once. MTS_CancelUpdate throws the copy away.
+     *
+     * MTS_BeginUpdate returns false if an update is already open or there is no master,
+     * and MTS_CommitUpdate returns false if no update was open. Deregistering the master
+     * or calling MTS_Reinitialize cancels an open update.
+     */
+    bool MTS_BeginUpdate();
+    bool MTS_CommitUpdate();
+    void MTS_CancelUpdate();
+
+    /*
+     * MIDI Tuning Standard SysEx, decoded by the library for masters which receive it.
+     * Every tuning format is understood: bulk dumps, single note changes and scale/octave
+     * tunings in one and two byte forms, with or without a bank. Scale/octave tunings with
+     * a channel bitmap (formats 8 and 9) change only the channels it names; the others
+     * change every channel. A dump's name becomes the scale name.
+     *
+     * The buffer may hold any number of messages, and everything in it lands as one
+     * master write, or in the open update between MTS_BeginUpdate and MTS_CommitUpdate.
+     * Messages are split and truncated messages handled as the client's MTS_ParseMIDIData
+     * does, and checksums are not checked. Returns the number of tuning messages found.
+     */
+    int MTS_SetTuningFromSysex(const uint8_t *data, int len);
+
+    /*
+     * Octave-periodic tunings, the common case of a 12 note scale repeated up and down the
+     * keyboard. MTS_SetOctaveTuning sets every channel in channelMask (bit n for channel n)
+     * to 12 offsets in cents from 12-TET, for C up to B, which repeat every periodCents
+     * (1200 for octaves) out from the octave starting at middle C. The library expands them
+     * into the channel tables, so clients see an ordinary retune. It returns false, changing
+     * nothing, without a master or if a value is not finite or the period is not positive.
+     *
+     * MTS_GetOctaveTuning reads a channel's offsets and period back, and returns false if
+     * the channel's notes have since been set any other way. A channel outside 0-15 reads
+     * channel 0. The 12-TET tuning after MTS_Reinitialize reads back as no offsets and a
+     * 1200 cent period, and MTS_SetTuningFromSysex sets this form for complete scale/octave
+     * messages.
+     */
+    bool MTS_SetOctaveTuning(uint16_t channelMask, const double *cents, double periodCents);
+    bool MTS_GetOctaveTuning(char midichannel, double *cents, double *periodCents);
+
+    /*
+     * Preloaded tuning slots, for switching scales instantly. Each slot holds all 16
+     * channel tables, the note filter and a scale name. A master fills one by staging an
+     * update as above and finishing it with MTS_CommitUpdateToSlot instead of
+     * MTS_CommitUpdate; the staged copy starts from the live tuning, not the slot.
+     * MTS_ActivateSlot makes a slot the live tuning in one write, which every client sees,
+     * including those holding MTS_GetTuningTable pointers. Refilling the active slot
+     * updates the live tuning too.
+     *
+     * MTS_GetActiveSlot returns the slot the live tuning was activated from, or -1 if no
+     * slot is active or a master has changed the live tuning since. The slot count is
+     * fixed when the library is built (MTS_REFERENCE_TUNING_SLOTS) and slot calls with an
+     * index outside it return false, leaving an open update open. MTS_ActivateSlot also
+     * returns false while an update is open. The snapshot calls copy as described above.
+     */
+    bool MTS_CommitUpdateToSlot(int slot);
+    bool MTS_ActivateSlot(int slot);
+    int MTS_GetNumTuningSlots();
+    int MTS_GetActiveSlot();
+    bool MTS_GetSlotTuningTableSnapshot(int slot, double *out, char midichannel);
+    bool MTS_GetSlotName(int slot, char *out, int size);
+
+    /*
+     * Scheduled tuning changes, so a retune can land on an exact sample rather than
+     * wherever a client's block happens to be. Times are opaque 64 bit values which the
+     * library only compares; master and clients must agree on the clock, for instance
+     * host sample position, or MTS_GetMonotonicTimeNs which is the same in every process
+     * on the machine.
+     *
+     * MTS_ScheduleNoteTuning queues a new frequency for a note on a channel (-1 for every
+     * channel) at a time. Clients call MTS_GetTuningEvents with their block's time range,
+     * [from, to), and get the events inside it, ordered by time, to split the block at.
+     * The live tables change when the master calls MTS_ApplyDueTuningEvents with the
+     * current time, which applies every queued event up to it in time order as a single
+     * write and returns how many it applied. Clients which only read the tables therefore
+     * pick a scheduled change up at the next apply after it is due.
+     *
+     * The queue holds a few hundred events; MTS_ScheduleNoteTuning returns false while it
+     * is full of events which haven't been applied. MTS_Reinitialize drops them all.
+     */
+    typedef struct MTSTuningEvent
+    {
+        uint64_t time;
+        double freq;
+        char midinote;
+        char midichannel; // -1 for every channel
+    } MTSTuningEvent;
+
+    bool MTS_ScheduleNoteTuning(double freq, char midinote, char midichannel, uint64_t time);
+    int MTS_ApplyDueTuningEvents(uint64_t now);
+    int MTS_GetTuningEvents(uint64_t from, uint64_t to, MTSTuningEvent *out, int maxEvents);
+    uint64_t MTS_GetMonotonicTimeNs();
+
+    /*
+     * Glides between tunings. MTS_CommitUpdateWithTransition publishes a staged update
+     * like MTS_CommitUpdate, so the tuning tables jump straight to the target, and also
+     * records a glide to it starting at startTime and lasting duration, on the same clock
+     * as scheduled events. Clients which want to follow the glide ask for the tuning at a
+     * time with MTS_GetTransitionFrequency or MTS_GetTransitionTuningTable (128 doubles).
+     * Frequencies move along a smoothstep curve in log frequency; before startTime they
+     * are the old tuning and from startTime + duration on the current one. Committing a
+     * new glide during one starts from wherever the old one had reached at its startTime.
+     * Channels outside 0-15 read channel 0.
+     */
+    bool MTS_CommitUpdateWithTransition(uint64_t startTime, uint64_t duration);
+    double MTS_GetTransitionFrequency(char midinote, char midichannel, uint64_t time);
+    bool MTS_GetTransitionTuningTable(double *out, char midichannel, uint64_t time);
+
+    /*
+     * Tables derived from a channel's tuning: the ratio of each note's frequency to its
+     * 12-TET frequency, that ratio in semitones, and log2 of the frequency. They are
+     * recomputed by the library whenever a master changes the tuning, so clients can
+     * read them instead of calling log per note. Like the tuning table pointers they
+     * stay valid for the life of the library, may be read mid update, and the
+     * generations below say when they have changed. Channels outside 0-15 give the
+     * tables for channel 0, which match the tuning table used when the channel is
+     * unknown. These return NULL if the library could not set up its shared memory.
+     */
+    const double *MTS_GetRatioTable(char midichannel);
+    const double *MTS_GetSemitoneTable(char midichannel);
+    const double *MTS_GetLog2FrequencyTable(char midichannel);
+
+    /*
+     * float32 copies of the tuning tables, kept in step with every master write, for
+     * clients whose oscillators run in single precision. Each table starts on a 64 byte
+     * boundary so it can be read with aligned SIMD loads. The pointers behave like the
+     * double ones from MTS_GetTuningTable and MTS_GetMultiChannelTuningTable; channels
+     * outside 0-15 give channel 0. They are NULL if the shared memory could not be set up.
+     */
+    const float *MTS_GetTuningTableFloat();
+    const float *MTS_GetMultiChannelTuningTableFloat(char midichannel);
+    bool MTS_GetMultiChannelTuningTableSnapshotFloat(float *out, char midichannel);
+
+    /*
+     * The whole note filter at once, so clients can test filtering with a bit operation
+     * rather than a call per note. MTS_GetNoteFilterMask sets bit (note & 63) of
+     * mask[note >> 6] for each note MTS_ShouldFilterNote would report filtered on the
+     * channel; for a channel outside 0-15 that is a note filtered on any channel.
+     * MTS_GetNoteFilterBitmap fills 32 words, two per channel in channel order, laid out
+     * the same way. Both return false if a consistent copy couldn't be taken.
+     */
+    bool MTS_GetNoteFilterMask(char midichannel, uint64_t *mask);
+    bool MTS_GetNoteFilterBitmap(uint64_t *bitmap);
+
+    /*
+     * Nearest mapped note to a frequency, by binary search of an index the library keeps
+     * up to date on every retune rather than a scan of the tables. Notes are nearest in
+     * pitch, ties go to the lower note (and channel), and filtered notes are never
+     * returned, matching MTS_FrequencyToNote and MTS_FrequencyToNoteAndChannel in the
+     * client API.
+     *
+     * MTS_FindNearestNote searches one channel's table, or for a channel outside 0-15
+     * channel 0's table skipping notes filtered on any channel. MTS_FindNearestNoteAndChannel
+     * searches every channel and sets *midichannel to the one to play the note on. If
+     * every note is filtered both return note 0 on channel 0.
+     */
+    char MTS_FindNearestNote(double freq, char midichannel);
+    char MTS_FindNearestNoteAndChannel(double freq, char *midichannel);
+
+    /*
+     * Change tracking, so clients can skip work when the tuning hasn't changed.
+     *
+     * MTS_GetTuningGeneration returns a number which increases whenever a note's
+     * frequency or filtering on that channel changes. Channels outside 0-15 report
+     * channel 0, whose table is the one used when the channel is unknown.
+     *
+     * MTS_GetDirtyNotes sets bit (note & 63) of mask[note >> 6] for every note on the
+     * channel which changed after sinceGeneration, and returns the generation those bits
+     * are correct up to; pass it back as sinceGeneration next time. Passing 0 marks
+     * every note which has ever been set. If the state can't be read consistently all
+     * bits are set and sinceGeneration is returned.
+     */
+    uint64_t MTS_GetTuningGeneration(char midichannel);
+    uint64_t MTS_GetDirtyNotes(char midichannel, uint64_t sinceGeneration, uint64_t *mask);
+
+    /*
+     * Sleeping until the tuning changes, for non realtime helpers which would otherwise
+     * poll. Do not call MTS_WaitForTuningChange from an audio thread.
+     *
+     * The change count moves whenever a master write changes a frequency, filter or the
+     * scale name, and when a master registers or deregisters. MTS_WaitForTuningChange
+     * blocks while the count still equals sinceChangeCount, for at most timeoutMs
+     * milliseconds (forever if negative), and returns the count it saw. Loop with
+     *
+     *     auto c = MTS_GetTuningChangeCount();
+     *     for (;;) { c = MTS_WaitForTuningChange(c, 1000); ...read the tuning... }
+     *
+     * On Linux this sleeps on a futex; elsewhere it polls every millisecond.
+     */
+    uint32_t MTS_GetTuningChangeCount();
+    uint32_t MTS_WaitForTuningChange(uint32_t sinceChangeCount, int timeoutMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MTS_DYLIB_REFERENCE_H
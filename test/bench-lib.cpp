@@ -0,0 +1,567 @@
+/*
+ * mts-bench: per call latency of every export of the reference library and of the
+ * client shim paths sitting on top of it, so changes to the hot paths can be measured.
+ *
+ * Each benchmark is timed in samples of a batch of calls, the batch sized so a sample
+ * takes a few microseconds, and reported as the distribution of ns per call over the
+ * samples. Run once as is and once with MTS_REFERENCE_DEACTIVATE_IPC=1 to compare with
+ * and without IPC. The benchmarks retune and reinitialize, so unless MTS_REFERENCE_SHM_NAME
+ * is set they use a segment of their own rather than the one a running session may be
+ * using (the sysv backend can't be moved like this).
+ *
+ *   mts-bench [--json file] [--filter text] [--samples n]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include "libMTSMaster.h"
+#include "libMTSClient.h"
+#include "mtsref-extensions.h"
+
+/*
+ * The shims attach to the library during static initialization and the library reads its
+ * environment once, so the bench's defaults have to go in before any other initializer.
+ */
+#if !defined(_WIN32)
+__attribute__((constructor(101))) static void benchEnvironment()
+{
+    setenv("MTS_REFERENCE_SHM_NAME", "/mts-esp-reference-bench", 0);
+    setenv("MTS_REFERENCE_LOG_LEVEL", "2", 0);
+}
+#endif
+
+/*
+ * The ESP client side exports the shim calls through, resolved directly so their cost
+ * can be told apart from the shim's.
+ */
+struct CoreExports
+{
+    void (*RegisterClient)(){nullptr};
+    void (*DeregisterClient)(){nullptr};
+    bool (*HasMaster)(){nullptr};
+    bool (*ShouldFilterNote)(char, char){nullptr};
+    bool (*ShouldFilterNoteMultiChannel)(char, char){nullptr};
+    const double *(*GetTuningTable)(){nullptr};
+    const double *(*GetMultiChannelTuningTable)(char){nullptr};
+    bool (*UseMultiChannelTuning)(char){nullptr};
+    const char *(*GetScaleName)(){nullptr};
+
+    bool resolve(const char *loc)
+    {
+#if defined(_WIN32)
+        auto handle = LoadLibraryA(loc);
+#define CORE(x) x = (decltype(x))GetProcAddress(handle, "MTS_" #x);
+#else
+        auto handle = dlopen(loc, RTLD_NOW);
+#define CORE(x) x = (decltype(x))dlsym(handle, "MTS_" #x);
+#endif
+        if (!handle)
+            return false;
+        CORE(RegisterClient)
+        CORE(DeregisterClient)
+        CORE(HasMaster)
+        CORE(ShouldFilterNote)
+        CORE(ShouldFilterNoteMultiChannel)
+        CORE(GetTuningTable)
+        CORE(GetMultiChannelTuningTable)
+        CORE(UseMultiChannelTuning)
+        CORE(GetScaleName)
+#undef CORE
+        return RegisterClient && DeregisterClient && HasMaster && ShouldFilterNote &&
+               ShouldFilterNoteMultiChannel && GetTuningTable && GetMultiChannelTuningTable &&
+               UseMultiChannelTuning && GetScaleName;
+    }
+};
+
+struct BenchResult
+{
+    std::string name;
+    int batch;
+    std::vector<double> ns; // per call, one entry per sample, sorted
+
+    double quantile(double q) const { return ns[(size_t)(q * (ns.size() - 1) + 0.5)]; }
+    double mean() const
+    {
+        double s = 0;
+        for (auto v : ns)
+            s += v;
+        return s / ns.size();
+    }
+};
+
+static std::vector<BenchResult> results;
+static std::string nameFilter;
+static int numSamples{200};
+
+// Keeps the optimizer from dropping a call whose result is otherwise unused
+template <typename T> inline void keep(const T &v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(v) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &v;
+#endif
+}
+
+template <typename F> void bench(const std::string &name, F &&f)
+{
+    if (!nameFilter.empty() && name.find(nameFilter) == std::string::npos)
+        return;
+
+    using clock = std::chrono::steady_clock;
+    auto timeBatch = [&f](int batch) {
+        auto start = clock::now();
+        for (int i = 0; i < batch; ++i)
+            f();
+        return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    };
+
+    // warm up, then grow the batch until a sample is well above the clock resolution
+    timeBatch(16);
+    int batch = 1;
+    while (batch < (1 << 20) && timeBatch(batch) < 5000)
+        batch *= 2;
+
+    BenchResult r{name, batch, {}};
+    r.ns.reserve(numSamples);
+    for (int s = 0; s < numSamples; ++s)
+        r.ns.push_back(timeBatch(batch) / batch);
+    std::sort(r.ns.begin(), r.ns.end());
+
+    std::cout << std::left << std::setw(58) << name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(10) << r.quantile(0.5) << std::setw(10)
+              << r.quantile(0.9) << std::setw(10) << r.quantile(0.99) << std::endl;
+    results.push_back(std::move(r));
+}
+
+static std::string jsonString(const std::string &s)
+{
+    std::string r = "\"";
+    for (auto c : s)
+    {
+        if (c == '"' || c == '\\')
+            r += '\\';
+        r += c;
+    }
+    return r + "\"";
+}
+
+static void writeJson(std::ostream &os, const char *lib, bool ipc)
+{
+    os << std::setprecision(3) << std::fixed;
+    os << "{\n  \"context\": {\"library\": " << jsonString(lib)
+       << ", \"ipc\": " << (ipc ? "true" : "false") << ", \"samples\": " << numSamples
+       << ", \"unit\": \"ns\"},\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        auto &r = results[i];
+        os << "    {\"name\": " << jsonString(r.name) << ", \"batch\": " << r.batch
+           << ", \"min\": " << r.ns.front() << ", \"median\": " << r.quantile(0.5)
+           << ", \"p90\": " << r.quantile(0.9) << ", \"p99\": " << r.quantile(0.99)
+           << ", \"max\": " << r.ns.back() << ", \"mean\": " << r.mean() << "}"
+           << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+}
+
+/*
+ * MTS SysEx messages for the parser benchmarks, built the way a controller sends them.
+ */
+static std::vector<unsigned char> bulkDumpMessage(int edo = 19)
+{
+    std::vector<unsigned char> m{0xF0, 0x7E, 0x7F, 0x08, 0x01, 0x00};
+    auto name = "Bench " + std::to_string(edo) + "EDO";
+    name.resize(16, ' ');
+    m.insert(m.end(), name.begin(), name.end());
+    for (int i = 0; i < 128; ++i)
+    {
+        double semis = 69 + (i - 69) * 12.0 / edo;
+        int note = (int)semis;
+        int frac = (int)((semis - note) * 16384);
+        if (frac > 16383)
+            frac = 16383;
+        m.push_back((unsigned char)note);
+        m.push_back((unsigned char)(frac >> 7));
+        m.push_back((unsigned char)(frac & 127));
+    }
+    unsigned char sum = 0;
+    for (size_t i = 1; i < m.size(); ++i)
+        sum ^= m[i];
+    m.push_back(sum & 127);
+    m.push_back(0xF7);
+    return m;
+}
+
+static std::vector<unsigned char> singleNoteMessage()
+{
+    return {0xF0, 0x7F, 0x7F, 0x08, 0x02, 0x00, 0x01, 69, 69, 0x10, 0x00, 0xF7};
+}
+
+static std::vector<unsigned char> scaleOctaveMessage(bool twoByte, int sign = 1)
+{
+    std::vector<unsigned char> m{0xF0, 0x7E, 0x7F, 0x08, (unsigned char)(twoByte ? 9 : 8),
+                                 0x03, 0x7F, 0x7F};
+    for (int i = 0; i < 12; ++i)
+    {
+        if (twoByte)
+        {
+            int v = 8192 + (i - 6) * 300 * sign;
+            m.push_back((unsigned char)(v >> 7));
+            m.push_back((unsigned char)(v & 127));
+        }
+        else
+        {
+            m.push_back((unsigned char)(64 + (i - 6) * sign));
+        }
+    }
+    m.push_back(0xF7);
+    return m;
+}
+
+static void masterBenchmarks()
+{
+    // Each retune benchmark starts from 12-TET and alternates between two detuned tables,
+    // so every call really changes the notes it writes. Writing what is already there
+    // takes an early out, timed separately as unchanged.
+    double table[128], tables[2][128];
+    for (int i = 0; i < 128; ++i)
+    {
+        table[i] = 440.0 * pow(2.0, (i - 69.0) / 12.0);
+        tables[0][i] = 440.0 * pow(2.0, (i - 69.0 + 0.1) / 12.0);
+        tables[1][i] = 440.0 * pow(2.0, (i - 69.0 - 0.1) / 12.0);
+    }
+    int n = 0;
+    auto retune = [&](const char *name, auto &&call) {
+        MTS_SetNoteTunings(table);
+        n = 0;
+        bench(name, call);
+    };
+
+    retune("master/MTS_SetNoteTunings", [&]() { MTS_SetNoteTunings(tables[n++ & 1]); });
+    retune("master/MTS_SetNoteTuning", [&]() {
+        MTS_SetNoteTuning(tables[(n >> 7) & 1][n & 127], n & 127);
+        n++;
+    });
+    retune("master/MTS_SetMultiChannelNoteTunings", [&]() {
+        MTS_SetMultiChannelNoteTunings(tables[(n >> 4) & 1], n & 15);
+        n++;
+    });
+    retune("master/MTS_SetMultiChannelNoteTuning", [&]() {
+        MTS_SetMultiChannelNoteTuning(tables[(n >> 11) & 1][n & 127], n & 127, (n >> 7) & 15);
+        n++;
+    });
+    MTS_SetNoteTunings(table);
+    bench("master/MTS_SetNoteTunings(unchanged)", [&]() { MTS_SetNoteTunings(table); });
+    bench("master/MTS_SetNoteTuning(unchanged)", [&]() {
+        MTS_SetNoteTuning(table[n & 127], n & 127);
+        n++;
+    });
+    bench("master/MTS_SetScaleName", [&]() { MTS_SetScaleName(n++ & 1 ? "Bench A" : "Bench B"); });
+    bench("master/MTS_FilterNote", [&]() {
+        MTS_FilterNote(n & 1, (n >> 1) & 127, -1);
+        n++;
+    });
+    bench("master/MTS_FilterNoteMultiChannel", [&]() {
+        MTS_FilterNoteMultiChannel(n & 1, (n >> 1) & 127, (n >> 8) & 15);
+        n++;
+    });
+    bench("master/MTS_ClearNoteFilter", []() { MTS_ClearNoteFilter(); });
+    bench("master/MTS_ClearNoteFilterMultiChannel",
+          [&]() { MTS_ClearNoteFilterMultiChannel(n++ & 15); });
+    bench("master/MTS_SetMultiChannel", [&]() { MTS_SetMultiChannel(true, n++ & 15); });
+    bench("master/MTS_HasIPC", []() { keep(MTS_HasIPC()); });
+    bench("master/MTS_GetNumClients", []() { keep(MTS_GetNumClients()); });
+    MTS_SetNoteTunings(tables[0]);
+}
+
+static void extensionBenchmarks()
+{
+    auto &ext = mtsref();
+    static double out[16 * 128];
+    static float outf[128];
+    uint64_t mask[32];
+    int n = 0;
+
+    bench("reader/MTS_GetTuningTableSnapshot",
+          [&]() { keep(ext.MTS_GetTuningTableSnapshot_fn(out)); });
+    bench("reader/MTS_GetMultiChannelTuningTableSnapshot",
+          [&]() { keep(ext.MTS_GetMultiChannelTuningTableSnapshot_fn(out, n++ & 15)); });
+    bench("reader/MTS_GetAllChannelsTuningTableSnapshot",
+          [&]() { keep(ext.MTS_GetAllChannelsTuningTableSnapshot_fn(out)); });
+    bench("reader/MTS_GetTuningTableFloat", [&]() { keep(ext.MTS_GetTuningTableFloat_fn()); });
+    bench("reader/MTS_GetMultiChannelTuningTableFloat",
+          [&]() { keep(ext.MTS_GetMultiChannelTuningTableFloat_fn(n++ & 15)); });
+    bench("reader/MTS_GetMultiChannelTuningTableSnapshotFloat",
+          [&]() { keep(ext.MTS_GetMultiChannelTuningTableSnapshotFloat_fn(outf, n++ & 15)); });
+    bench("reader/MTS_GetRatioTable", [&]() { keep(ext.MTS_GetRatioTable_fn(n++ & 15)); });
+    bench("reader/MTS_GetSemitoneTable", [&]() { keep(ext.MTS_GetSemitoneTable_fn(n++ & 15)); });
+    bench("reader/MTS_GetLog2FrequencyTable",
+          [&]() { keep(ext.MTS_GetLog2FrequencyTable_fn(n++ & 15)); });
+    bench("reader/MTS_FindNearestNote", [&]() {
+        keep(ext.MTS_FindNearestNote_fn(30.0 + (n & 1023) * 7.3, (n >> 10) & 15));
+        n++;
+    });
+    bench("reader/MTS_FindNearestNoteAndChannel", [&]() {
+        char ch;
+        keep(ext.MTS_FindNearestNoteAndChannel_fn(30.0 + (n++ & 1023) * 7.3, &ch));
+    });
+    bench("reader/MTS_GetNoteFilterMask",
+          [&]() { keep(ext.MTS_GetNoteFilterMask_fn(n++ & 15, mask)); });
+    bench("reader/MTS_GetNoteFilterBitmap", [&]() { keep(ext.MTS_GetNoteFilterBitmap_fn(mask)); });
+    bench("reader/MTS_GetTuningGeneration",
+          [&]() { keep(ext.MTS_GetTuningGeneration_fn(n++ & 15)); });
+    bench("reader/MTS_GetDirtyNotes",
+          [&]() { keep(ext.MTS_GetDirtyNotes_fn(n++ & 15, 0, mask)); });
+    bench("reader/MTS_GetTuningChangeCount", [&]() { keep(ext.MTS_GetTuningChangeCount_fn()); });
+    bench("reader/MTS_WaitForTuningChange", [&]() {
+        // a count which has already moved on, so this returns without waiting
+        keep(ext.MTS_WaitForTuningChange_fn(ext.MTS_GetTuningChangeCount_fn() - 1, 0));
+    });
+    bench("reader/MTS_GetMonotonicTimeNs", [&]() { keep(ext.MTS_GetMonotonicTimeNs_fn()); });
+
+    // staged updates and slots
+    bench("update/MTS_BeginUpdate+MTS_CommitUpdate", [&]() {
+        ext.MTS_BeginUpdate_fn();
+        MTS_SetNoteTuning(400.0 + (n++ & 127), 69);
+        keep(ext.MTS_CommitUpdate_fn());
+    });
+    bench("update/MTS_BeginUpdate+MTS_CancelUpdate", [&]() {
+        ext.MTS_BeginUpdate_fn();
+        ext.MTS_CancelUpdate_fn();
+    });
+    bench("update/MTS_BeginUpdate+MTS_CommitUpdateToSlot", [&]() {
+        ext.MTS_BeginUpdate_fn();
+        keep(ext.MTS_CommitUpdateToSlot_fn(n++ & 1));
+    });
+    bench("update/MTS_ActivateSlot", [&]() { keep(ext.MTS_ActivateSlot_fn(n++ & 1)); });
+
+    // MTS SysEx decoded by the library, each a single write, alternating between two
+    // messages so every call changes the tables
+    std::vector<unsigned char> bulk[2] = {bulkDumpMessage(19), bulkDumpMessage(17)};
+    std::vector<unsigned char> oneByte[2] = {scaleOctaveMessage(false, 1),
+                                             scaleOctaveMessage(false, -1)};
+    bench("master/MTS_SetTuningFromSysex(bulk dump)", [&]() {
+        auto &m = bulk[n++ & 1];
+        keep(ext.MTS_SetTuningFromSysex_fn(m.data(), (int)m.size()));
+    });
+    bench("master/MTS_SetTuningFromSysex(scale octave 1 byte)", [&]() {
+        auto &m = oneByte[n++ & 1];
+        keep(ext.MTS_SetTuningFromSysex_fn(m.data(), (int)m.size()));
+    });
+
+    // octave-periodic tunings, alternating between two so every call changes the tables
+    double cents[2][12] = {{0, -24, -7, 10, -14, 3, -21, -3, -27, -10, 7, -17}, {}};
+    double period;
+    bench("master/MTS_SetOctaveTuning(16 channels)",
+          [&]() { keep(ext.MTS_SetOctaveTuning_fn(0xFFFF, cents[n++ & 1], 1200.)); });
+    bench("reader/MTS_GetOctaveTuning",
+          [&]() { keep(ext.MTS_GetOctaveTuning_fn(n++ & 15, cents[1], &period)); });
+    bench("reader/MTS_GetNumTuningSlots", [&]() { keep(ext.MTS_GetNumTuningSlots_fn()); });
+    bench("reader/MTS_GetActiveSlot", [&]() { keep(ext.MTS_GetActiveSlot_fn()); });
+    bench("reader/MTS_GetSlotTuningTableSnapshot",
+          [&]() { keep(ext.MTS_GetSlotTuningTableSnapshot_fn(n++ & 1, out, 0)); });
+    char name[64];
+    bench("reader/MTS_GetSlotName", [&]() { keep(ext.MTS_GetSlotName_fn(n++ & 1, name, 64)); });
+
+    // scheduled events
+    MTSTuningEvent events[256];
+    bench("events/MTS_ScheduleNoteTuning+MTS_ApplyDueTuningEvents", [&]() {
+        ext.MTS_ScheduleNoteTuning_fn(400.0 + (n & 127), n & 127, -1, 0);
+        n++;
+        keep(ext.MTS_ApplyDueTuningEvents_fn(1));
+    });
+    bench("events/MTS_ApplyDueTuningEvents(none due)",
+          [&]() { keep(ext.MTS_ApplyDueTuningEvents_fn(1)); });
+    bench("events/MTS_GetTuningEvents",
+          [&]() { keep(ext.MTS_GetTuningEvents_fn(0, UINT64_MAX, events, 256)); });
+
+    // transitions, with one left gliding for the readers
+    bench("transition/MTS_BeginUpdate+MTS_CommitUpdateWithTransition", [&]() {
+        ext.MTS_BeginUpdate_fn();
+        MTS_SetNoteTuning(400.0 + (n++ & 127), 69);
+        keep(ext.MTS_CommitUpdateWithTransition_fn(ext.MTS_GetMonotonicTimeNs_fn(), 1000000000));
+    });
+    auto now = ext.MTS_GetMonotonicTimeNs_fn();
+    bench("transition/MTS_GetTransitionFrequency", [&]() {
+        keep(ext.MTS_GetTransitionFrequency_fn(n & 127, (n >> 7) & 15, now + 500000000));
+        n++;
+    });
+    bench("transition/MTS_GetTransitionTuningTable",
+          [&]() { keep(ext.MTS_GetTransitionTuningTable_fn(out, n++ & 15, now + 500000000)); });
+}
+
+static void coreClientBenchmarks(const CoreExports &core)
+{
+    int n = 0;
+    bench("core/MTS_HasMaster", [&]() { keep(core.HasMaster()); });
+    bench("core/MTS_ShouldFilterNote", [&]() {
+        keep(core.ShouldFilterNote(n & 127, ((n >> 7) & 15)));
+        n++;
+    });
+    bench("core/MTS_ShouldFilterNoteMultiChannel", [&]() {
+        keep(core.ShouldFilterNoteMultiChannel(n & 127, ((n >> 7) & 15)));
+        n++;
+    });
+    bench("core/MTS_GetTuningTable", [&]() { keep(core.GetTuningTable()); });
+    bench("core/MTS_GetMultiChannelTuningTable",
+          [&]() { keep(core.GetMultiChannelTuningTable(n++ & 15)); });
+    bench("core/MTS_UseMultiChannelTuning", [&]() { keep(core.UseMultiChannelTuning(n++ & 15)); });
+    bench("core/MTS_GetScaleName", [&]() { keep(core.GetScaleName()); });
+}
+
+static void shimBenchmarks(MTSClient *cl)
+{
+    int n = 0;
+    bench("shim/freq", [&]() {
+        keep(MTS_NoteToFrequency(cl, n & 127, (n >> 7) & 15));
+        n++;
+    });
+    bench("shim/freq(no channel)", [&]() { keep(MTS_NoteToFrequency(cl, n++ & 127, -1)); });
+    bench("shim/ratio", [&]() {
+        keep(MTS_RetuningAsRatio(cl, n & 127, (n >> 7) & 15));
+        n++;
+    });
+    bench("shim/semitones", [&]() {
+        keep(MTS_RetuningInSemitones(cl, n & 127, (n >> 7) & 15));
+        n++;
+    });
+    bench("shim/shouldFilterNote", [&]() {
+        keep(MTS_ShouldFilterNote(cl, n & 127, (n >> 7) & 15));
+        n++;
+    });
+    bench("shim/freqToNote", [&]() {
+        keep(MTS_FrequencyToNote(cl, 30.0 + (n & 1023) * 7.3, (n >> 10) & 15));
+        n++;
+    });
+    bench("shim/freqToNoteAndChannel", [&]() {
+        char ch;
+        keep(MTS_FrequencyToNoteAndChannel(cl, 30.0 + (n++ & 1023) * 7.3, &ch));
+    });
+
+    // a block of 16 voices, as a synth renders them
+    char notes[16], chans[16];
+    double vals[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        notes[i] = 40 + i * 3;
+        chans[i] = i;
+    }
+    bench("shim/freqs(16 voices)", [&]() {
+        MTS_NotesToFrequencies(cl, notes, chans, vals, 16);
+        keep(vals[0]);
+    });
+    bench("shim/ratios(16 voices)", [&]() {
+        MTS_NotesToRatios(cl, notes, chans, vals, 16);
+        keep(vals[0]);
+    });
+    bench("shim/semitones(16 voices)", [&]() {
+        MTS_NotesToSemitones(cl, notes, chans, vals, 16);
+        keep(vals[0]);
+    });
+    bench("shim/hasMaster", [&]() { keep(MTS_HasMaster(cl)); });
+    bench("shim/getScaleName", [&]() { keep(MTS_GetScaleName(cl)); });
+
+    auto bulk = bulkDumpMessage();
+    auto single = singleNoteMessage();
+    auto oneByte = scaleOctaveMessage(false);
+    auto twoByte = scaleOctaveMessage(true);
+    bench("shim/parseMIDIData(bulk dump)",
+          [&]() { MTS_ParseMIDIDataU(cl, bulk.data(), (int)bulk.size()); });
+    bench("shim/parseMIDIData(single note)",
+          [&]() { MTS_ParseMIDIDataU(cl, single.data(), (int)single.size()); });
+    bench("shim/parseMIDIData(scale octave 1 byte)",
+          [&]() { MTS_ParseMIDIDataU(cl, oneByte.data(), (int)oneByte.size()); });
+    bench("shim/parseMIDIData(scale octave 2 byte)",
+          [&]() { MTS_ParseMIDIDataU(cl, twoByte.data(), (int)twoByte.size()); });
+}
+
+static void clientLifecycleBenchmarks(const CoreExports &core)
+{
+    // with the master and a client holding the segment, so nothing is created or released
+    bench("lifecycle/MTS_RegisterClient+MTS_DeregisterClient", [&]() {
+        core.RegisterClient();
+        core.DeregisterClient();
+    });
+    bench("lifecycle/shim MTS_RegisterClient+MTS_DeregisterClient",
+          []() { MTS_DeregisterClient(MTS_RegisterClient()); });
+}
+
+static void masterLifecycleBenchmarks()
+{
+    // these create and release the segment each time, so run once nothing else holds it
+    bench("lifecycle/MTS_RegisterMaster+MTS_DeregisterMaster", []() {
+        MTS_RegisterMaster();
+        MTS_DeregisterMaster();
+    });
+    bench("lifecycle/MTS_Reinitialize", []() { MTS_Reinitialize(); });
+    MTS_DeregisterMaster();
+}
+
+int main(int argc, char **argv)
+{
+    const char *jsonOut = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            jsonOut = argv[++i];
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            nameFilter = argv[++i];
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            numSamples = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+        else
+        {
+            std::cout << "Usage: " << argv[0]
+                      << " [--json file] [--filter text] [--samples n]" << std::endl;
+            return 2;
+        }
+    }
+
+
+    auto loc = getenv("MTS_LIB_LOCATION");
+    CoreExports core;
+    if (!loc || !core.resolve(loc) || !mtsref().MTS_GetTransitionTuningTable_fn)
+    {
+        std::cout << "Set MTS_LIB_LOCATION to a reference library to benchmark" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+    bool ipc = MTS_HasIPC();
+    std::cout << "Benchmarking " << loc << (ipc ? " with IPC" : " in process") << ", "
+              << numSamples << " samples, ns per call" << std::endl;
+    std::cout << std::left << std::setw(58) << "" << std::right << std::setw(10) << "median"
+              << std::setw(10) << "p90" << std::setw(10) << "p99" << std::endl;
+
+    masterBenchmarks();
+    coreClientBenchmarks(core);
+    shimBenchmarks(cl);
+    extensionBenchmarks();
+    clientLifecycleBenchmarks(core);
+
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    masterLifecycleBenchmarks();
+
+    if (jsonOut)
+    {
+        std::ofstream f(jsonOut);
+        writeJson(f, loc, ipc);
+        if (!f)
+        {
+            std::cout << "Unable to write " << jsonOut << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * Differential fuzzing of the client's MTS SysEx parser against sysex-reference.h.
+ *
+ * Built with MTSREF_LIBFUZZER this is a libFuzzer target. Otherwise it is a standalone
+ * driver which replays corpus files and directories given on the command line or, with
+ * none, runs a seeded generator of mutated MTS messages, then reports parse throughput:
+ *
+ *   mts-fuzz-sysex [--iterations n] [--seed n] [corpus file or dir ...]
+ *   mts-fuzz-sysex --write-corpus dir
+ *
+ * --write-corpus writes a few messages of every format to seed a libFuzzer corpus.
+ *
+ * Each input's first byte says how to split the rest into separate parse calls, since
+ * MIDI arrives in pieces. Run it without a master, as the client only reads its own
+ * SysEx tuning when no master is connected.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <vector>
+#include "libMTSClient.h"
+#include "sysex-reference.h"
+
+static void reportMismatch(const uint8_t *data, size_t size, const char *what)
+{
+    std::cout << "MISMATCH in " << what << " for input of " << size << " bytes:";
+    for (size_t i = 0; i < size; ++i)
+        printf(" %02x", data[i]);
+    std::cout << std::endl;
+    abort();
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    auto cl = MTS_RegisterClient();
+    if (MTS_HasMaster(cl))
+    {
+        std::cout << "A master is connected, so the SysEx tuning can't be compared" << std::endl;
+        abort();
+    }
+    ReferenceSysexTuning ref;
+
+    // up to four calls, cut at points taken from the first byte
+    auto body = data + 1;
+    int len = (int)size - 1;
+    int pieces = 1 + (data[0] & 3);
+    int start = 0;
+    for (int p = 0; p < pieces; ++p)
+    {
+        int end = p + 1 == pieces ? len : start + (len - start) * ((data[0] >> 2) + 1) / 64;
+        MTS_ParseMIDIDataU(cl, body + start, end - start);
+        ref.decode(body + start, end - start);
+        start = end;
+    }
+
+    // the client computes frequencies with a polynomial rather than pow
+    for (int ch = -1; ch < 16; ++ch)
+    {
+        auto &want = ref.retuning[ch < 0 ? 0 : ch]; // channel 0's table when it isn't known
+        for (int i = 0; i < 128; ++i)
+            if (std::fabs(MTS_NoteToFrequency(cl, i, ch) - want[i]) > want[i] * 1e-14)
+                reportMismatch(data, size, "retuning");
+    }
+    if (strcmp(MTS_GetScaleName(cl), ref.name) != 0)
+        reportMismatch(data, size, "scale name");
+
+    MTS_DeregisterClient(cl);
+    return 0;
+}
+
+#if !MTSREF_LIBFUZZER
+
+/*
+ * Well formed messages of every format, which the generator then damages
+ */
+static void push7(std::vector<uint8_t> &m, std::mt19937 &rng, int n)
+{
+    for (int i = 0; i < n; ++i)
+        m.push_back(rng() & 127);
+}
+
+static std::vector<uint8_t> makeMessage(std::mt19937 &rng, int format = -1)
+{
+    if (format < 0)
+        format = rng() % 10;
+    std::vector<uint8_t> m{0xF0, (uint8_t)(rng() & 1 ? 0x7E : 0x7F), (uint8_t)(rng() & 127),
+                           0x08, (uint8_t)format};
+    switch (format)
+    {
+    case 1:
+    case 4:
+        push7(m, rng, format == 4 ? 18 : 17);
+        for (int i = 0; i < 128; ++i)
+        {
+            if (rng() % 16 == 0)
+            {
+                // leave this note alone
+                m.insert(m.end(), {0x7F, 0x7F, 0x7F});
+                continue;
+            }
+            m.push_back((uint8_t)std::min(127, std::max(0, i + (int)(rng() % 9) - 4)));
+            push7(m, rng, 2);
+        }
+        push7(m, rng, 1);
+        break;
+    case 2:
+    case 7:
+    {
+        push7(m, rng, format == 7 ? 2 : 1);
+        int count = rng() % 12;
+        m.push_back(count);
+        for (int i = 0; i < count; ++i)
+            push7(m, rng, 4);
+        break;
+    }
+    case 5:
+    case 6:
+        push7(m, rng, 18 + (format == 6 ? 24 : 12) + 1);
+        break;
+    case 8:
+    case 9:
+        push7(m, rng, 3 + (format == 9 ? 24 : 12));
+        break;
+    default:
+        push7(m, rng, format == 3 ? 2 : 1);
+        break;
+    }
+    if (format == 1 || format == 4 || format == 5 || format == 6)
+    {
+        // mostly right, so the client's whole message path is exercised as well
+        uint8_t sum = 0;
+        for (size_t i = 1; i + 1 < m.size(); ++i)
+            sum ^= m[i];
+        m.back() = rng() % 8 ? sum & 127 : rng() & 127;
+    }
+    m.push_back(0xF7);
+    return m;
+}
+
+static std::vector<uint8_t> makeInput(std::mt19937 &rng)
+{
+    std::vector<uint8_t> in{(uint8_t)(rng() & 255)};
+    int messages = 1 + rng() % 3;
+    for (int i = 0; i < messages; ++i)
+    {
+        auto m = makeMessage(rng);
+        switch (rng() % 8)
+        {
+        case 0: // cut short
+            m.resize(rng() % m.size());
+            break;
+        case 1: // a few bytes changed to anything
+            for (int k = 0; k < 3; ++k)
+                m[rng() % m.size()] = rng() & 255;
+            break;
+        case 2: // clock bytes mixed in
+            for (int k = 0; k < 4; ++k)
+                m.insert(m.begin() + rng() % m.size(), 0xF8);
+            break;
+        case 3: // a new message started in the middle
+            m.insert(m.begin() + 1 + rng() % (m.size() - 1), 0xF0);
+            break;
+        case 4: // the end marker lost
+            m.pop_back();
+            break;
+        default:
+            break;
+        }
+        in.insert(in.end(), m.begin(), m.end());
+    }
+    if (rng() % 16 == 0)
+        for (int k = rng() % 64; k > 0; --k)
+            in.push_back(rng() & 255);
+    return in;
+}
+
+static std::vector<uint8_t> readFile(const std::filesystem::path &p)
+{
+    std::ifstream f(p, std::ios::binary);
+    return {std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+}
+
+static void reportThroughput(uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<std::vector<uint8_t>> corpus;
+    size_t bytes{0};
+    while (corpus.size() < 2000)
+    {
+        auto m = makeMessage(rng);
+        bytes += m.size();
+        corpus.push_back(std::move(m));
+    }
+
+    auto cl = MTS_RegisterClient();
+    ReferenceSysexTuning ref;
+    auto time = [&](auto &&parse) {
+        auto start = std::chrono::steady_clock::now();
+        int rounds = 0;
+        do
+        {
+            for (auto &m : corpus)
+                parse(m.data(), (int)m.size());
+            rounds++;
+        } while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(300));
+        std::chrono::duration<double> s = std::chrono::steady_clock::now() - start;
+        return (double)bytes * rounds / s.count() / 1e6;
+    };
+    auto client = time([cl](const uint8_t *d, int n) { MTS_ParseMIDIDataU(cl, d, n); });
+    auto reference = time([&ref](const uint8_t *d, int n) { ref.decode(d, n); });
+    MTS_DeregisterClient(cl);
+
+    std::cout << "Parse throughput over " << corpus.size() << " messages of every format: client "
+              << client << " MB/s, reference " << reference << " MB/s" << std::endl;
+}
+
+static int writeCorpus(const std::filesystem::path &dir)
+{
+    std::filesystem::create_directories(dir);
+    std::mt19937 rng(1);
+    for (int format = 0; format < 10; ++format)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            // the leading byte asks for a single parse call
+            std::vector<uint8_t> in{0};
+            auto m = makeMessage(rng, format);
+            in.insert(in.end(), m.begin(), m.end());
+            auto name = "format" + std::to_string(format) + "-" + std::to_string(k);
+            std::ofstream f(dir / name, std::ios::binary);
+            f.write((const char *)in.data(), in.size());
+            if (!f)
+                return 1;
+        }
+    }
+    std::cout << "Wrote corpus to " << dir << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations{100000};
+    uint32_t seed{1};
+    std::vector<std::filesystem::path> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--write-corpus") == 0 && i + 1 < argc)
+            return writeCorpus(argv[i + 1]);
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = atol(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = (uint32_t)atol(argv[++i]);
+        else
+            paths.emplace_back(argv[i]);
+    }
+
+    if (!paths.empty())
+    {
+        int files{0};
+        for (auto &p : paths)
+        {
+            std::vector<std::filesystem::path> inputs;
+            if (std::filesystem::is_directory(p))
+            {
+                for (auto &e : std::filesystem::recursive_directory_iterator(p))
+                    if (e.is_regular_file())
+                        inputs.push_back(e.path());
+            }
+            else
+            {
+                inputs.push_back(p);
+            }
+            for (auto &f : inputs)
+            {
+                auto d = readFile(f);
+                LLVMFuzzerTestOneInput(d.data(), d.size());
+                files++;
+            }
+        }
+        std::cout << "Replayed " << files << " inputs" << std::endl;
+        return 0;
+    }
+
+    std::mt19937 rng(seed);
+    for (long i = 0; i < iterations; ++i)
+    {
+        auto in = makeInput(rng);
+        LLVMFuzzerTestOneInput(in.data(), in.size());
+    }
+    std::cout << "Ran " << iterations << " generated inputs from seed " << seed << std::endl;
+    reportThroughput(seed);
+    return 0;
+}
+
+#endif
@@ -20,9 +20,29 @@ typedef void (WINAPI* CoTaskMemFreeFunc) (LPVOID);
 #endif
 
 #include <iostream>
+#include <stdint.h>
+#include <string.h>
 
 const static double ln2=0.693147180559945309417;
 const static double ratioToSemitones=17.31234049066756088832; // 12./log(2.)
+const static double invFactorial[14]={1.,1.,1./2.,1./6.,1./24.,1./120.,1./720.,1./5040.,1./40320.,1./362880.,1./3628800.,1./39916800.,1./479001600.,1./6227020800.};
+
+// 440*2^((semitones-69)/12) from a polynomial rather than pow, so that a loop over a whole table
+// vectorises. Agrees with pow to within a couple of ulp for any note a tuning message can name.
+static inline double noteToFrequency(double semitones)
+{
+    double x=(semitones-69.)*(1./12.);
+    double t=x+6755399441055744.; // 1.5*2^52, which leaves x rounded to the nearest octave in the low bits
+    double y=(x-(t-6755399441055744.))*ln2,p=invFactorial[13]; // 2^x = 2^octave*e^y with |y| <= ln2/2
+    for (int i=12;i>=0;i--) p=p*y+invFactorial[i];
+    uint64_t bits;memcpy(&bits,&t,sizeof(bits));bits=(bits+1023)<<52; // the octave as a double's exponent
+    double octave;memcpy(&octave,&bits,sizeof(octave));
+    return 440.*octave*p;
+}
+static void notesToFrequencies(const double *semitones,double *freqs,int n)
+{
+    for (int i=0;i<n;i++) freqs[i]=noteToFrequency(semitones[i]);
+}
 typedef void (*mts_void)(void);
 typedef bool (*mts_bool)(void);
 typedef bool (*mts_bcc)(char,char);
@@ -30,20 +50,25 @@ typedef const double *(*mts_cd)(void);
 typedef const double *(*mts_cdc)(char);
 typedef bool (*mts_bc)(char);
 typedef const char *(*mts_pcc)(void);
+typedef uint64_t (*mts_ullc)(char);
+typedef char (*mts_cdc_note)(double,char);
+typedef char (*mts_cdpc_note)(double,char*);
 
 struct mtsclientglobal
 {
-    mtsclientglobal() : RegisterClient(0), DeregisterClient(0), HasMaster(0), ShouldFilterNote(0), ShouldFilterNoteMultiChannel(0), GetTuning(0), GetMultiChannelTuning(0), UseMultiChannelTuning(0), GetScaleName(0), esp_retuning(0), handle(0)
+    mtsclientglobal() : RegisterClient(0), DeregisterClient(0), HasMaster(0), ShouldFilterNote(0), ShouldFilterNoteMultiChannel(0), GetTuning(0), GetMultiChannelTuning(0), UseMultiChannelTuning(0), GetScaleName(0), GetTuningGeneration(0), GetRatioTable(0), GetSemitoneTable(0), FindNearestNote(0), FindNearestNoteAndChannel(0), esp_retuning(0), handle(0)
     {
         for (int i=0;i<128;i++) iet[i]=1./(440.*pow(2.,(i-69.)/12.));
         load_lib();
         if (GetTuning) esp_retuning=GetTuning();
         for (int i=0;i<16;i++) multi_channel_esp_retuning[i]=GetMultiChannelTuning?GetMultiChannelTuning(static_cast<char>(i)):0;
+        for (int i=0;i<17;i++) ratio_tables[i]=GetRatioTable?GetRatioTable(static_cast<char>(i<16?i:-1)):0; // [16] goes with esp_retuning
+        for (int i=0;i<17;i++) semitone_tables[i]=GetSemitoneTable?GetSemitoneTable(static_cast<char>(i<16?i:-1)):0;
     }
     virtual inline bool isOnline() const {return esp_retuning && HasMaster && HasMaster();}
     
-    mts_void RegisterClient,DeregisterClient;mts_bool HasMaster;mts_bcc ShouldFilterNote,ShouldFilterNoteMultiChannel;mts_cd GetTuning;mts_cdc GetMultiChannelTuning;mts_bc UseMultiChannelTuning;mts_pcc GetScaleName; // Interface to lib
-    double iet[128];const double *esp_retuning;const double *multi_channel_esp_retuning[16]; // tuning tables
+    mts_void RegisterClient,DeregisterClient;mts_bool HasMaster;mts_bcc ShouldFilterNote,ShouldFilterNoteMultiChannel;mts_cd GetTuning;mts_cdc GetMultiChannelTuning;mts_bc UseMultiChannelTuning;mts_pcc GetScaleName;mts_ullc GetTuningGeneration;mts_cdc GetRatioTable,GetSemitoneTable;mts_cdc_note FindNearestNote;mts_cdpc_note FindNearestNoteAndChannel; // Interface to lib
+    double iet[128];const double *esp_retuning;const double *multi_channel_esp_retuning[16];const double *ratio_tables[17],*semitone_tables[17]; // tuning tables
     
 #ifdef MTS_ESP_WIN
     virtual void load_lib()
@@ -114,6 +139,11 @@ struct mtsclientglobal
         GetMultiChannelTuning           =(mts_cdc)  GetProcAddress(handle,"MTS_GetMultiChannelTuningTable");
         UseMultiChannelTuning           =(mts_bc)   GetProcAddress(handle,"MTS_UseMultiChannelTuning");
         GetScaleName                    =(mts_pcc)  GetProcAddress(handle,"MTS_GetScaleName");
+        GetTuningGeneration             =(mts_ullc) GetProcAddress(handle,"MTS_GetTuningGeneration"); // optional, reference library only
+        GetRatioTable                   =(mts_cdc)  GetProcAddress(handle,"MTS_GetRatioTable"); // optional, reference library only
+        GetSemitoneTable                =(mts_cdc)  GetProcAddress(handle,"MTS_GetSemitoneTable"); // optional, reference library only
+        FindNearestNote                 =(mts_cdc_note)  GetProcAddress(handle,"MTS_FindNearestNote"); // optional, reference library only
+        FindNearestNoteAndChannel       =(mts_cdpc_note) GetProcAddress(handle,"MTS_FindNearestNoteAndChannel"); // optional, reference library only
     }
     virtual ~mtsclientglobal() {if (handle) FreeLibrary(handle);}
     HINSTANCE handle;
@@ -135,6 +165,11 @@ struct mtsclientglobal
         GetMultiChannelTuning           =(mts_cdc)  dlsym(handle,"MTS_GetMultiChannelTuningTable");
         UseMultiChannelTuning           =(mts_bc)   dlsym(handle,"MTS_UseMultiChannelTuning");
         GetScaleName                    =(mts_pcc)  dlsym(handle,"MTS_GetScaleName");
+        GetTuningGeneration             =(mts_ullc) dlsym(handle,"MTS_GetTuningGeneration"); // optional, reference library only
+        GetRatioTable                   =(mts_cdc)  dlsym(handle,"MTS_GetRatioTable"); // optional, reference library only
+        GetSemitoneTable                =(mts_cdc)  dlsym(handle,"MTS_GetSemitoneTable"); // optional, reference library only
+        FindNearestNote                 =(mts_cdc_note)  dlsym(handle,"MTS_FindNearestNote"); // optional, reference library only
+        FindNearestNoteAndChannel       =(mts_cdpc_note) dlsym(handle,"MTS_FindNearestNoteAndChannel"); // optional, reference library only
     }
     virtual ~mtsclientglobal() {if (handle) dlclose(handle);}
     void *handle;
@@ -145,9 +180,10 @@ static mtsclientglobal global;
 
 struct MTSClient
 {
-    MTSClient() : tuningName("12-TET"), supportsNoteFiltering(false), supportsMultiChannelNoteFiltering(false), supportsMultiChannelTuning(false), freqRequestReceived(false), supportsMTSSysex(false)
+    MTSClient() : tuningName("12-TET"), supportsNoteFiltering(false), supportsMultiChannelNoteFiltering(false), supportsMultiChannelTuning(false), freqRequestReceived(false), supportsMTSSysex(false), retuningVersion(0)
     {
-        for (int i=0;i<128;i++) retuning[i]=440.*pow(2.,(i-69.)/12.);
+        for (int i=0;i<33;i++) semitoneCache[i].valid=false;
+        for (int ch=0;ch<16;ch++) for (int i=0;i<128;i++) retuning[ch][i]=440.*pow(2.,(i-69.)/12.);
         if (global.RegisterClient) global.RegisterClient();
     }
     virtual ~MTSClient() {if (global.DeregisterClient) global.DeregisterClient();}
@@ -156,7 +192,7 @@ struct MTSClient
     {
         freqRequestReceived=true;
         supportsMultiChannelTuning=!(midichannel&~15);
-        if (!global.isOnline()) return retuning[midinote&127];
+        if (!global.isOnline()) return localTable(midichannel)[midinote&127];
         if ((!supportsNoteFiltering || supportsMultiChannelNoteFiltering) && supportsMultiChannelTuning && global.UseMultiChannelTuning && global.UseMultiChannelTuning(midichannel) && global.multi_channel_esp_retuning[midichannel&15])
         {
             return global.multi_channel_esp_retuning[midichannel&15][midinote&127];
@@ -167,24 +203,111 @@ struct MTSClient
     {
         freqRequestReceived=true;
         supportsMultiChannelTuning=!(midichannel&~15);
-        if (!global.isOnline()) return supportsMTSSysex?retuning[midinote&127]*global.iet[midinote&127]:1.;
+        if (!global.isOnline()) return supportsMTSSysex?localTable(midichannel)[midinote&127]*global.iet[midinote&127]:1.;
         if ((!supportsNoteFiltering || supportsMultiChannelNoteFiltering) && supportsMultiChannelTuning && global.UseMultiChannelTuning && global.UseMultiChannelTuning(midichannel) && global.multi_channel_esp_retuning[midichannel&15])
         {
+            if (global.ratio_tables[midichannel&15]) return global.ratio_tables[midichannel&15][midinote&127];
             return global.multi_channel_esp_retuning[midichannel&15][midinote&127]*global.iet[midinote&127];
         }
+        if (global.ratio_tables[16]) return global.ratio_tables[16][midinote&127];
         return global.esp_retuning[midinote&127]*global.iet[midinote&127];
     }
     inline double semitones(char midinote,char midichannel)
     {
         freqRequestReceived=true;
         supportsMultiChannelTuning=!(midichannel&~15);
-        if (!global.isOnline()) return supportsMTSSysex?ratioToSemitones*log(retuning[midinote&127]*global.iet[midinote&127]):0.;
+        if (!global.isOnline()) return supportsMTSSysex?ratioToSemitones*log(localTable(midichannel)[midinote&127]*global.iet[midinote&127]):0.;
         if ((!supportsNoteFiltering || supportsMultiChannelNoteFiltering) && supportsMultiChannelTuning && global.UseMultiChannelTuning && global.UseMultiChannelTuning(midichannel) && global.multi_channel_esp_retuning[midichannel&15])
         {
+            if (global.semitone_tables[midichannel&15]) return global.semitone_tables[midichannel&15][midinote&127];
             return ratioToSemitones*log(global.multi_channel_esp_retuning[midichannel&15][midinote&127]*global.iet[midinote&127]);
         }
+        if (global.semitone_tables[16]) return global.semitone_tables[16][midinote&127];
         return ratioToSemitones*log(global.esp_retuning[midinote&127]*global.iet[midinote&127]);
     }
+    // Batched versions of freq, ratio and semitones. Which table each channel reads is worked out once per call
+    // instead of once per note, leaving a branch free gather. Ratios and semitones come from the library's derived
+    // tables when it has them, else semitones are taken from 128 entry tables of logs which are only recomputed
+    // when the library reports the tuning has changed.
+    static inline int tableIndex(char midichannel) {return (midichannel&~15)?16:midichannel;} // 16 is the non multi-channel table
+    inline void resolveTables(const double **tables,const double *const *derived=0) // derived: 17 library tables to use instead
+    {
+        bool multi=(!supportsNoteFiltering || supportsMultiChannelNoteFiltering) && global.UseMultiChannelTuning;
+        for (int ch=0;ch<16;ch++)
+        {
+            bool useChannel=multi && global.UseMultiChannelTuning(static_cast<char>(ch)) && global.multi_channel_esp_retuning[ch];
+            tables[ch]=derived?derived[useChannel?ch:16]:useChannel?global.multi_channel_esp_retuning[ch]:global.esp_retuning;
+        }
+        tables[16]=derived?derived[16]:global.esp_retuning;
+    }
+    inline const double *cachedSemitones(int slot,const double *table,uint64_t version)
+    {
+        SemitoneCache &c=semitoneCache[slot];
+        if (!c.valid || c.table!=table || c.version!=version)
+        {
+            for (int i=0;i<128;i++) c.semitones[i]=ratioToSemitones*log(table[i]*global.iet[i]);
+            c.table=table;c.version=version;c.valid=true;
+        }
+        return c.semitones;
+    }
+    inline void freqs(const char *midinotes,const char *midichannels,double *out,int n)
+    {
+        if (n<=0) return;
+        if (!global.isOnline())
+        {
+            freqRequestReceived=true;
+            supportsMultiChannelTuning=midichannels && !(midichannels[n-1]&~15);
+            for (int i=0;i<n;i++) out[i]=localTable(midichannels?midichannels[i]:static_cast<char>(-1))[midinotes[i]&127];
+            return;
+        }
+        gather(0,midinotes,midichannels,out,n);
+    }
+    inline void gather(const double *const *derived,const char *midinotes,const char *midichannels,double *out,int n)
+    {
+        freqRequestReceived=true;
+        supportsMultiChannelTuning=midichannels && !(midichannels[n-1]&~15);
+        const double *tables[17];resolveTables(tables,derived);
+        if (!midichannels) {for (int i=0;i<n;i++) out[i]=tables[16][midinotes[i]&127];return;}
+        for (int i=0;i<n;i++) out[i]=tables[tableIndex(midichannels[i])][midinotes[i]&127];
+    }
+    inline void ratios(const char *midinotes,const char *midichannels,double *out,int n)
+    {
+        if (n<=0) return;
+        if (!global.isOnline() && !supportsMTSSysex) {freqRequestReceived=true;for (int i=0;i<n;i++) out[i]=1.;return;}
+        if (global.isOnline() && global.ratio_tables[16]) {gather(global.ratio_tables,midinotes,midichannels,out,n);return;}
+        freqs(midinotes,midichannels,out,n);
+        for (int i=0;i<n;i++) out[i]*=global.iet[midinotes[i]&127];
+    }
+    inline void semitonesBatch(const char *midinotes,const char *midichannels,double *out,int n)
+    {
+        if (n<=0) return;
+        freqRequestReceived=true;
+        supportsMultiChannelTuning=midichannels && !(midichannels[n-1]&~15);
+        if (!global.isOnline())
+        {
+            if (!supportsMTSSysex) {for (int i=0;i<n;i++) out[i]=0.;return;}
+            for (int i=0;i<n;i++)
+            {
+                int ch=midichannels && !(midichannels[i]&~15)?midichannels[i]:0;
+                out[i]=cachedSemitones(17+ch,retuning[ch],retuningVersion)[midinotes[i]&127];
+            }
+            return;
+        }
+        if (global.semitone_tables[16]) {gather(global.semitone_tables,midinotes,midichannels,out,n);return;}
+        const double *tables[17];resolveTables(tables);
+        if (!global.GetTuningGeneration) // no way to know when a cache is stale
+        {
+            for (int i=0;i<n;i++) {int note=midinotes[i]&127;out[i]=ratioToSemitones*log(tables[midichannels?tableIndex(midichannels[i]):16][note]*global.iet[note]);}
+            return;
+        }
+        const double *semis[17]={0};
+        for (int i=0;i<n;i++)
+        {
+            int t=midichannels?tableIndex(midichannels[i]):16;
+            if (!semis[t]) semis[t]=cachedSemitones(t,tables[t],global.GetTuningGeneration(tables[t]==global.esp_retuning?static_cast<char>(-1):static_cast<char>(t)));
+            out[i]=semis[t][midinotes[i]&127];
+        }
+    }
     inline bool shouldFilterNote(char midinote,char midichannel)
     {
         supportsNoteFiltering=true;
@@ -200,7 +323,8 @@ struct MTSClient
     inline char freqToNote(double freq,char midichannel)
     {
         bool online=global.isOnline(),multiChannel=false;
-        const double *freqs=online?global.esp_retuning:retuning;
+        if (online && global.FindNearestNote) return global.FindNearestNote(freq,midichannel); // the library keeps a sorted index
+        const double *freqs=online?global.esp_retuning:localTable(midichannel);
         if (online && !(midichannel&~15) && global.UseMultiChannelTuning && global.UseMultiChannelTuning(midichannel) && global.multi_channel_esp_retuning[midichannel])
         {
             freqs=global.multi_channel_esp_retuning[midichannel];
@@ -228,6 +352,7 @@ struct MTSClient
     inline char freqToNote(double freq,char *midichannel)
     {
         if (!midichannel) return freqToNote(freq,static_cast<char>(-1));
+        if (global.isOnline() && global.FindNearestNoteAndChannel) return global.FindNearestNoteAndChannel(freq,midichannel);
         if (global.isOnline() && global.UseMultiChannelTuning)
         {
             int channelsInUse[16];int nMultiChannels=0;
@@ -261,18 +386,23 @@ struct MTSClient
     inline void parseMIDIData(const unsigned char *buffer,int len)
     {
         supportsMTSSysex=true;
-        int sysex_ctr=0,sysex_value=0,note=0,numTunings=0;
-        /*int bank=-1,prog=0,checksum=0,deviceID=0;short int channelBitmap=0;bool realtime=false;*/ // unused for now
+        int sysex_ctr=0,sysex_value=0,note=0,numTunings=0,channelBitmap=0xFFFF;char name[16]; // the name is only taken once it has all arrived
+        /*int bank=-1,prog=0,checksum=0,deviceID=0;bool realtime=false;*/ // unused for now
         eSysexState state=eIgnoring;eMTSFormat format=eBulk;
         for (int i=0;i<len;i++)
         {
             unsigned char b=buffer[i];
             if (b==0xF7) {state=eIgnoring;continue;}
-            if (b>0x7F && b!=0xF0) continue;
+            if (b==0xF0) // a new message, even if the last was cut short
+            {
+                int whole=parseWholeMessage(buffer+i,len-i);
+                if (whole) {i+=whole-1;state=eIgnoring;continue;}
+                state=eMatchingSysex;continue;
+            }
+            if (b>0x7F) continue;
             switch (state)
             {
                 case eIgnoring:
-                    if (b==0xF0) state=eMatchingSysex;
                     break;
                 case eMatchingSysex:
                     sysex_ctr=0;
@@ -289,7 +419,7 @@ struct MTSClient
                     }
                     break;
                 case eMatchingMTS:
-                    sysex_ctr=0;
+                    sysex_ctr=0;sysex_value=0;note=0;channelBitmap=0xFFFF; // nothing carries over from an earlier message
                     switch (b)
                     {
                         case 0: format=eRequest;state=eMatchingProg; break;
@@ -311,21 +441,22 @@ struct MTSClient
                     break;
                 case eMatchingProg:
                     /*prog=b;*/
-                    if (format==eSingle) state=eNumTunings;else {state=eTuningName;tuningName[0]='\0';}
+                    if (format==eRequest) state=eIgnoring; // dump requests change nothing
+                    else if (format==eSingle) state=eNumTunings;else state=eTuningName;
                     break;
                 case eTuningName:
-                    tuningName[sysex_ctr]=static_cast<char>(b);
-                    if (++sysex_ctr>=16) {tuningName[16]='\0';sysex_ctr=0;state=eTuningData;}
+                    name[sysex_ctr]=static_cast<char>(b);
+                    if (++sysex_ctr>=16) {memcpy(tuningName,name,16);tuningName[16]='\0';sysex_ctr=0;state=eTuningData;}
                     break;
                 case eNumTunings:
-                    numTunings=b;sysex_ctr=0;state=eTuningData;
+                    numTunings=b;sysex_ctr=0;state=numTunings?eTuningData:eIgnoring;
                     break;
                 case eMatchingChannel:
                     switch (sysex_ctr++)
                     {
-                        case 0: /*for (int j=14;j<16;j++) channelBitmap|=(1<<j);*/ break;
-                        case 1: /*for (int j=7;j<14;j++) channelBitmap|=(1<<j);*/ break;
-                        case 2: /*for (int j=0;j<7;j++) channelBitmap|=(1<<j);*/sysex_ctr=0;state=eTuningData; break;
+                        case 0: channelBitmap=(b&3)<<14; break; // channels 15 and 16
+                        case 1: channelBitmap|=b<<7; break; // 8 to 14
+                        case 2: channelBitmap|=b;sysex_ctr=0;state=eTuningData; break; // 1 to 7
                     }
                     break;
                 case eTuningData:
@@ -336,7 +467,7 @@ struct MTSClient
                             sysex_ctr++;
                             if ((sysex_ctr&3)==3)
                             {
-                                if (!(note==0x7F && sysex_value==16383)) updateTuning(note,(sysex_value>>14)&127,(sysex_value&16383)/16383.);
+                                if (sysex_value!=0x1FFFFF) updateTuning(note,(sysex_value>>14)&127,(sysex_value&16383)/16384.); // 7F 7F 7F leaves the note alone
                                 sysex_value=0;sysex_ctr++;
                                 if (++note>=128) state=eCheckSum;
                             }
@@ -346,13 +477,13 @@ struct MTSClient
                             sysex_ctr++;
                             if (!(sysex_ctr&3))
                             {
-                                if (!(note==0x7F && sysex_value==16383)) updateTuning((sysex_value>>21)&127,(sysex_value>>14)&127,(sysex_value&16383)/16383.);
+                                if ((sysex_value&0x1FFFFF)!=0x1FFFFF) updateTuning((sysex_value>>21)&127,(sysex_value>>14)&127,(sysex_value&16383)/16384.);
                                 sysex_value=0;
                                 if (++note>=numTunings) state=eIgnoring;
                             }
                             break;
                         case eScaleOctOneByte: case eScaleOctOneByteExt:
-                            for (int j=sysex_ctr;j<128;j+=12) updateTuning(j,j,(static_cast<double>(b)-64.)*0.01);
+                            for (int j=sysex_ctr;j<128;j+=12) updateTuning(j,j,(static_cast<double>(b)-64.)*0.01,channelBitmap);
                             if (++sysex_ctr>=12) state=format==eScaleOctOneByte?eCheckSum:eIgnoring;
                             break;
                         case eScaleOctTwoByte: case eScaleOctTwoByteExt:
@@ -361,7 +492,8 @@ struct MTSClient
                             if (!(sysex_ctr&1))
                             {
                                 double detune=(static_cast<double>(sysex_value&16383)-8192.)/(sysex_value>8192?8191.:8192.);
-                                for (int j=note;j<128;j+=12) updateTuning(j,j,detune);
+                                for (int j=note;j<128;j+=12) updateTuning(j,j,detune,channelBitmap);
+                                sysex_value=0;
                                 if (++note>=12) state=format==eScaleOctTwoByte?eCheckSum:eIgnoring;
                             }
                             break;
@@ -375,19 +507,82 @@ struct MTSClient
             }
         }
     }
-    inline void updateTuning(int note,int retuneNote,double detune)
+    // A bulk dump or scale/octave message from F0 to F7 with no other status bytes inside is
+    // checked for length and checksum, decoded into a staging table and then copied over the
+    // tuning in one go. Returns the length of the message, or 0 to leave it to the byte at a
+    // time parser, which gives the same result for any message this takes, so a checksum this
+    // rejects still has its entries applied there.
+    inline int parseWholeMessage(const unsigned char *m,int len)
+    {
+        if (len<6 || (m[1]!=0x7E && m[1]!=0x7F) || m[3]!=0x08) return 0;
+        int format=m[4],data=0,values=12;bool twoByte=format==6 || format==9,hasName=true,hasChecksum=true;
+        switch (format)
+        {
+            case 1: data=22;values=128*3; break; // program, name
+            case 4: data=23;values=128*3; break; // bank, program, name
+            case 5: case 6: data=23;values=twoByte?24:12; break; // bank, program, name
+            case 8: case 9: data=8;values=twoByte?24:12;hasName=false;hasChecksum=false; break; // channel bitmap
+            default: return 0;
+        }
+        int size=data+values+(hasChecksum?1:0)+1;
+        if (len<size || m[size-1]!=0xF7) return 0;
+        unsigned char sum=0,status=0;
+        for (int i=1;i<size-1;i++) {status|=m[i];sum^=m[i];}
+        if (status&0x80) return 0;
+        if (hasChecksum && sum) return 0; // the checksum is the XOR of everything from the id on
+
+        double semitones[128],freqs[128];bool changed[128],all=true;int channels=format>=8?(m[5]&3)<<14|m[6]<<7|m[7]:0xFFFF; // formats 8 and 9 name their channels
+        const unsigned char *p=m+data;
+        if (format==1 || format==4)
+        {
+            for (int n=0;n<128;n++,p+=3)
+            {
+                changed[n]=!(p[0]==0x7F && p[1]==0x7F && p[2]==0x7F); // 7F 7F 7F leaves the note alone
+                all=all && changed[n];
+                semitones[n]=p[0]+static_cast<double>((p[1]<<7)|p[2])/16384.;
+            }
+        }
+        else
+        {
+            double detune[12];
+            for (int pc=0;pc<12;pc++)
+            {
+                if (twoByte) {int v=(p[2*pc]<<7)|p[2*pc+1];detune[pc]=(static_cast<double>(v)-8192.)/(v>8192?8191.:8192.);}
+                else detune[pc]=(static_cast<double>(p[pc])-64.)*0.01;
+            }
+            for (int n=0;n<128;n++) {changed[n]=true;semitones[n]=n+detune[n%12];}
+        }
+        notesToFrequencies(semitones,freqs,128);
+
+        if (hasName) {memcpy(tuningName,m+data-16,16);tuningName[16]='\0';}
+        for (int ch=0;ch<16;ch++)
+        {
+            if (!(channels&(1<<ch))) continue;
+            if (all) memcpy(retuning[ch],freqs,sizeof(freqs));
+            else for (int n=0;n<128;n++) if (changed[n]) retuning[ch][n]=freqs[n];
+        }
+        retuningVersion++;
+        return size;
+    }
+    inline void updateTuning(int note,int retuneNote,double detune,int channels=0xFFFF)
     {
         if (note<0 || note>127 || retuneNote<0 || retuneNote>127) return;
-        retuning[note]=440.*pow(2.,((retuneNote+detune)-69.)/12.);
+        double f=noteToFrequency(retuneNote+detune);
+        for (int ch=0;ch<16;ch++) if (channels&(1<<ch)) retuning[ch][note]=f;
+        retuningVersion++;
     }
+    inline const double *localTable(char midichannel) const {return retuning[(midichannel&~15)?0:midichannel];} // channel 0's when it isn't known
     const char *getScaleName() {return global.isOnline() && global.GetScaleName?global.GetScaleName():tuningName;}
     
     enum eSysexState {eIgnoring=0,eMatchingSysex,eSysexValid,eMatchingMTS,eMatchingBank,eMatchingProg,eMatchingChannel,eTuningName,eNumTunings,eTuningData,eCheckSum};
     enum eMTSFormat {eRequest=0,eBulk,eSingle,eScaleOctOneByte,eScaleOctTwoByte,eScaleOctOneByteExt,eScaleOctTwoByteExt};
 
-    double retuning[128];
+    double retuning[16][128]; // from SysEx, for when there is no master
     char tuningName[17];
     bool supportsNoteFiltering,supportsMultiChannelNoteFiltering,supportsMultiChannelTuning,freqRequestReceived,supportsMTSSysex;
+    struct SemitoneCache {const double *table;uint64_t version;bool valid;double semitones[128];};
+    SemitoneCache semitoneCache[33]; // one per table from resolveTables, then one per channel of the local retuning tables
+    uint64_t retuningVersion;
 };
 
 static char freqToNoteET(double freq)
@@ -426,4 +621,7 @@ char MTS_FrequencyToNoteAndChannel(MTSClient *c,double freq,char *midichannel)
 const char *MTS_GetScaleName(MTSClient *c)                                      {return c?c->getScaleName():"";}
 void MTS_ParseMIDIDataU(MTSClient *c,const unsigned char *buffer,int len)       {if (c) c->parseMIDIData(buffer,len);}
 void MTS_ParseMIDIData(MTSClient *c,const char *buffer,int len)                 {if (c) c->parseMIDIData(reinterpret_cast<const unsigned char*>(buffer),len);}
+void MTS_NotesToFrequencies(MTSClient *c,const char *midinotes,const char *midichannels,double *freqs,int n)     {if (c) c->freqs(midinotes,midichannels,freqs,n);else for (int i=0;i<n;i++) freqs[i]=1./global.iet[midinotes[i]&127];}
+void MTS_NotesToRatios(MTSClient *c,const char *midinotes,const char *midichannels,double *ratios,int n)        {if (c) c->ratios(midinotes,midichannels,ratios,n);else for (int i=0;i<n;i++) ratios[i]=1.;}
+void MTS_NotesToSemitones(MTSClient *c,const char *midinotes,const char *midichannels,double *semitones,int n)  {if (c) c->semitonesBatch(midinotes,midichannels,semitones,n);else for (int i=0;i<n;i++) semitones[i]=0.;}
 
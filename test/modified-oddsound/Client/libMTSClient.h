@@ -135,6 +135,12 @@ extern "C" {
     extern double MTS_NoteToFrequency(MTSClient *client, char midinote, char midichannel);
     extern double MTS_RetuningInSemitones(MTSClient *client, char midinote, char midichannel);
     extern double MTS_RetuningAsRatio(MTSClient *client, char midinote, char midichannel);
+
+    // Batched retuning for n notes at once, e.g. every active voice each block. midichannels may be NULL if no channels are known, else it holds one channel per note as above.
+    // Results are identical to calling the single note versions in a loop but the tuning tables are resolved once per call. Not part of the ODDSound client library.
+    extern void MTS_NotesToFrequencies(MTSClient *client, const char *midinotes, const char *midichannels, double *freqs, int n);
+    extern void MTS_NotesToSemitones(MTSClient *client, const char *midinotes, const char *midichannels, double *semitones, int n);
+    extern void MTS_NotesToRatios(MTSClient *client, const char *midinotes, const char *midichannels, double *ratios, int n);
     
     // MTS_FrequencyToNote() is a helper function returning the note number whose pitch is closest to the supplied frequency. Two versions are provided:
     // The first is for the simplest case: supply a frequency and get a note number back.
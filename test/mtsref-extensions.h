@@ -0,0 +1,56 @@
+/*
+ * Resolve the reference library extension exports declared in mts-dylib-reference.h
+ * so the tests can call them. Uses the same MTS_LIB_LOCATION override as the
+ * modified oddsound shims, so it binds to the already loaded library.
+ */
+
+#ifndef MTSREF_EXTENSIONS_H
+#define MTSREF_EXTENSIONS_H
+
+#include <cstdlib>
+#include <iostream>
+
+#include "mts-dylib-reference.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+struct MTSRefExtensions
+{
+#define MTSREF_EXT(x) decltype(&x) x##_fn{nullptr};
+#include "mtsref-extensions.inc"
+#undef MTSREF_EXT
+
+    MTSRefExtensions()
+    {
+        auto loc = getenv("MTS_LIB_LOCATION");
+        if (!loc)
+        {
+            std::cout << "MTS_LIB_LOCATION is required to resolve extensions" << std::endl;
+            return;
+        }
+#if defined(_WIN32)
+        auto handle = LoadLibraryA(loc);
+#define MTSREF_EXT(x) x##_fn = (decltype(&x))GetProcAddress(handle, #x);
+#else
+        auto handle = dlopen(loc, RTLD_NOW);
+#define MTSREF_EXT(x) x##_fn = (decltype(&x))dlsym(handle, #x);
+#endif
+        if (!handle)
+            return;
+#include "mtsref-extensions.inc"
+#undef MTSREF_EXT
+    }
+};
+
+inline MTSRefExtensions &mtsref()
+{
+    static MTSRefExtensions ext;
+    return ext;
+}
+
+#endif // MTSREF_EXTENSIONS_H
@@ -0,0 +1,454 @@
+/*
+ * mts-stress: many processes on one shared segment at once, the way a DAW loading a large
+ * template brings up dozens of plugin instances together.
+ *
+ * The parent holds a client, then forks master contenders, which race to become master and
+ * retune, and clients, which churn registrations while reading the tuning. One more client
+ * is killed part way through. Every snapshot a client takes must be a whole table from a
+ * single write, the client count must match what the live children hold, and once
+ * everyone has gone the segment must have been released. Read latency percentiles under
+ * this contention are reported at the end.
+ *
+ *   mts-stress [--masters n] [--clients n] [--seconds n]
+ *
+ * Uses the sysv backend unless MTS_REFERENCE_IPC_BACKEND says otherwise.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "libMTSMaster.h"
+#include "libMTSClient.h"
+#include "mtsref-extensions.h"
+
+#define LOGDAT                                                                                     \
+    std::cout << "test/stress-lib.cpp"                                                             \
+              << ":" << __LINE__ << " [" << __func__ << "] "
+
+/*
+ * The shims attach to the library during static initialization and the library reads its
+ * environment once, so these defaults have to go in before any other initializer.
+ */
+__attribute__((constructor(101))) static void stressEnvironment()
+{
+    setenv("MTS_REFERENCE_IPC_BACKEND", "sysv", 0);
+    setenv("MTS_REFERENCE_SHM_NAME", "/mts-esp-reference-stress", 0);
+    setenv("MTS_REFERENCE_LOG_LEVEL", "2", 0);
+}
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr int maxLatencySamples{20000};
+
+struct ClientReport
+{
+    int32_t held;   // registrations still held at the end of the run
+    int32_t errors; // torn or otherwise wrong snapshots
+    int64_t snapshots, failedSnapshots, registrations;
+    int32_t numSnapshotNs, numFreqNs; // then this many uint32_t ns of each
+};
+
+static bool writeAll(int fd, const void *d, size_t n)
+{
+    auto p = (const char *)d;
+    while (n > 0)
+    {
+        auto w = write(fd, p, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *d, size_t n)
+{
+    auto p = (char *)d;
+    while (n > 0)
+    {
+        auto r = read(fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// Blocks until the parent closes the other end of the pipe
+static void waitForPipeClose(int fd)
+{
+    char c;
+    while (read(fd, &c, 1) != 0 && errno == EINTR)
+        ;
+}
+
+/*
+ * Contenders only ever publish 12-TET tables on some base frequency, whole, so any table a
+ * reader sees must be one of those; a mixture of two writes breaks the ratio to note 69.
+ */
+static void fillTable(double *t, double base)
+{
+    for (int i = 0; i < 128; ++i)
+        t[i] = base * pow(2.0, (i - 69) / 12.0);
+}
+
+static bool tableIsWhole(const double *t)
+{
+    double expect[128];
+    fillTable(expect, t[69]);
+    for (int i = 0; i < 128; ++i)
+        if (fabs(t[i] - expect[i]) > 1e-9 * expect[i])
+            return false;
+    return true;
+}
+
+static int masterContender(int id, int goFd, clock_type::time_point deadline)
+{
+    waitForPipeClose(goFd);
+    auto &ext = mtsref();
+    std::mt19937 rng(id);
+    double table[128];
+    bool registered{false};
+
+    while (clock_type::now() < deadline)
+    {
+        if (!registered && MTS_CanRegisterMaster())
+        {
+            MTS_RegisterMaster();
+            registered = true;
+        }
+        if (!registered)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        auto base = 300.0 + (rng() % 2000) * 0.1;
+        if (rng() & 1)
+        {
+            fillTable(table, base);
+            MTS_SetNoteTunings(table);
+        }
+        else if (ext.MTS_BeginUpdate_fn())
+        {
+            // staged note by note, so only the commit may make it visible
+            fillTable(table, base);
+            for (int i = 0; i < 128; ++i)
+                MTS_SetNoteTuning(table[i], i);
+            ext.MTS_CommitUpdate_fn();
+        }
+
+        if (rng() % 64 == 0)
+        {
+            MTS_DeregisterMaster();
+            registered = false;
+        }
+
+        // far faster than any master retunes, but leaving readers some room
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    if (registered)
+        MTS_DeregisterMaster();
+    return 0;
+}
+
+static int stressClient(int id, int goFd, int reportFd, int releaseFd,
+                        clock_type::time_point deadline)
+{
+    waitForPipeClose(goFd);
+    auto &ext = mtsref();
+    std::mt19937 rng(1000 + id);
+
+    std::vector<MTSClient *> held;
+    int hold = 1 + id % 3;
+    ClientReport rep{};
+    std::vector<uint32_t> snapshotNs, freqNs;
+    snapshotNs.reserve(maxLatencySamples);
+    freqNs.reserve(maxLatencySamples);
+    static double all[16 * 128];
+
+    while (clock_type::now() < deadline)
+    {
+        // churn towards, and around, the number this client means to hold at the end
+        if ((int)held.size() < hold || rng() % 8 == 0)
+        {
+            held.push_back(MTS_RegisterClient());
+            rep.registrations++;
+        }
+        else if (held.size() > 1 && rng() % 8 == 0)
+        {
+            MTS_DeregisterClient(held.back());
+            held.pop_back();
+        }
+
+        for (int r = 0; r < 32; ++r)
+        {
+            auto s = clock_type::now();
+            bool ok = ext.MTS_GetAllChannelsTuningTableSnapshot_fn(all);
+            auto e = clock_type::now();
+            if (snapshotNs.size() < maxLatencySamples)
+                snapshotNs.push_back(
+                    (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(e - s).count());
+
+            rep.snapshots++;
+            if (!ok)
+            {
+                // as an audio thread would, leave it until later rather than spin
+                rep.failedSnapshots++;
+                std::this_thread::yield();
+                continue;
+            }
+            for (int ch = 0; ch < 16; ++ch)
+            {
+                if (!tableIsWhole(all + ch * 128) || memcmp(all, all + ch * 128, 128 * 8))
+                {
+                    rep.errors++;
+                    break;
+                }
+            }
+
+            s = clock_type::now();
+            auto f = MTS_NoteToFrequency(held[0], rng() & 127, rng() & 15);
+            e = clock_type::now();
+            if (freqNs.size() < maxLatencySamples)
+                freqNs.push_back(
+                    (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(e - s).count());
+            if (!(f > 0))
+                rep.errors++;
+        }
+    }
+    while ((int)held.size() > hold)
+    {
+        MTS_DeregisterClient(held.back());
+        held.pop_back();
+    }
+
+    rep.held = (int32_t)held.size();
+    rep.numSnapshotNs = (int32_t)snapshotNs.size();
+    rep.numFreqNs = (int32_t)freqNs.size();
+    if (!writeAll(reportFd, &rep, sizeof(rep)) ||
+        !writeAll(reportFd, snapshotNs.data(), snapshotNs.size() * sizeof(uint32_t)) ||
+        !writeAll(reportFd, freqNs.data(), freqNs.size() * sizeof(uint32_t)))
+        return 1;
+
+    // hold on until the parent has counted us
+    waitForPipeClose(releaseFd);
+    for (auto c : held)
+        MTS_DeregisterClient(c);
+    return rep.errors ? 2 : 0;
+}
+
+static void reportLatency(const char *what, std::vector<uint32_t> &ns)
+{
+    if (ns.empty())
+        return;
+    std::sort(ns.begin(), ns.end());
+    auto q = [&ns](double p) { return ns[(size_t)(p * (ns.size() - 1))]; };
+    LOGDAT << what << " ns over " << ns.size() << " reads: p50 " << q(0.5) << " p90 " << q(0.9)
+           << " p99 " << q(0.99) << " p99.9 " << q(0.999) << " max " << ns.back() << std::endl;
+}
+
+static bool segmentReleased()
+{
+    auto backend = getenv("MTS_REFERENCE_IPC_BACKEND");
+    if (strcmp(backend, "sysv") == 0)
+    {
+        auto key = ftok(getenv("MTS_LIB_LOCATION"), 63);
+        return shmget(key, 0, 0) < 0 && errno == ENOENT;
+    }
+    auto fd = shm_open(getenv("MTS_REFERENCE_SHM_NAME"), O_RDONLY, 0);
+    if (fd >= 0)
+        close(fd);
+    return fd < 0 && errno == ENOENT;
+}
+
+int main(int argc, char **argv)
+{
+    int numMasters{4}, numClients{16}, seconds{2};
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--masters") == 0 && i + 1 < argc)
+            numMasters = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+            numClients = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = atoi(argv[++i]);
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--masters n] [--clients n] [--seconds n]"
+                      << std::endl;
+            return 2;
+        }
+    }
+
+    if (!getenv("MTS_LIB_LOCATION") || !mtsref().MTS_GetAllChannelsTuningTableSnapshot_fn)
+    {
+        LOGDAT << "Set MTS_LIB_LOCATION to a reference library to stress" << std::endl;
+        return 1;
+    }
+    if (!MTS_HasIPC())
+    {
+        LOGDAT << "IPC disabled; nothing to stress" << std::endl;
+        return 0;
+    }
+
+    LOGDAT << numMasters << " master contenders and " << numClients << " clients for "
+           << seconds << "s on the " << getenv("MTS_REFERENCE_IPC_BACKEND") << " backend"
+           << std::endl;
+
+    // the parent's client keeps the segment alive however the children come and go
+    auto own = MTS_RegisterClient();
+    auto deadline = clock_type::now() + std::chrono::seconds(seconds);
+
+    int goPipe[2], releasePipe[2];
+    if (pipe(goPipe) != 0 || pipe(releasePipe) != 0)
+        return 1;
+
+    std::vector<pid_t> masters, clients;
+    std::vector<int> reportFds;
+    for (int i = 0; i < numMasters; ++i)
+    {
+        auto pid = fork();
+        if (pid == 0)
+        {
+            close(goPipe[1]);
+            _exit(masterContender(i, goPipe[0], deadline));
+        }
+        masters.push_back(pid);
+    }
+    for (int i = 0; i < numClients; ++i)
+    {
+        int rp[2];
+        if (pipe(rp) != 0)
+            return 1;
+        auto pid = fork();
+        if (pid == 0)
+        {
+            close(goPipe[1]);
+            close(releasePipe[1]);
+            close(rp[0]);
+            _exit(stressClient(i, goPipe[0], rp[1], releasePipe[0], deadline));
+        }
+        close(rp[1]);
+        clients.push_back(pid);
+        reportFds.push_back(rp[0]);
+    }
+
+    // one client which dies without deregistering, in the middle of everything
+    int crashPipe[2];
+    if (pipe(crashPipe) != 0)
+        return 1;
+    auto crasher = fork();
+    if (crasher == 0)
+    {
+        close(goPipe[1]);
+        waitForPipeClose(goPipe[0]);
+        for (int i = 0; i < 3; ++i)
+            MTS_RegisterClient();
+        char c{1};
+        writeAll(crashPipe[1], &c, 1);
+        for (;;)
+            pause();
+    }
+
+    close(goPipe[1]);
+    char c;
+    readAll(crashPipe[0], &c, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 500));
+    kill(crasher, SIGKILL);
+    waitpid(crasher, nullptr, 0);
+
+    int failures{0};
+    int32_t expected{1};
+    int64_t snapshots{0}, failedSnapshots{0}, registrations{0}, errors{0};
+    std::vector<uint32_t> snapshotNs, freqNs;
+    for (auto fd : reportFds)
+    {
+        ClientReport rep;
+        if (!readAll(fd, &rep, sizeof(rep)))
+        {
+            LOGDAT << "A client died before reporting" << std::endl;
+            failures++;
+            continue;
+        }
+        std::vector<uint32_t> s(rep.numSnapshotNs), f(rep.numFreqNs);
+        readAll(fd, s.data(), s.size() * sizeof(uint32_t));
+        readAll(fd, f.data(), f.size() * sizeof(uint32_t));
+        snapshotNs.insert(snapshotNs.end(), s.begin(), s.end());
+        freqNs.insert(freqNs.end(), f.begin(), f.end());
+
+        expected += rep.held;
+        snapshots += rep.snapshots;
+        failedSnapshots += rep.failedSnapshots;
+        registrations += rep.registrations;
+        errors += rep.errors;
+    }
+
+    // every client is parked holding its registrations, and the crashed one is gone
+    auto counted = MTS_GetNumClients();
+    LOGDAT << "Clients counted " << counted << " expected " << expected << std::endl;
+    if (counted != expected)
+        failures++;
+
+    close(releasePipe[1]);
+    for (auto pid : masters)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+    for (auto pid : clients)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+
+    counted = MTS_GetNumClients();
+    LOGDAT << "Clients counted after the children left " << counted << std::endl;
+    if (counted != 1)
+        failures++;
+
+    LOGDAT << snapshots << " snapshots, " << failedSnapshots << " ("
+           << (snapshots ? 100.0 * failedSnapshots / snapshots : 0.0)
+           << "%) gave up under contention, " << errors << " wrong; " << registrations
+           << " client registrations" << std::endl;
+    if (errors)
+        failures++;
+    reportLatency("MTS_GetAllChannelsTuningTableSnapshot", snapshotNs);
+    reportLatency("MTS_NoteToFrequency", freqNs);
+
+    MTS_DeregisterClient(own);
+    if (!segmentReleased())
+    {
+        LOGDAT << "Segment still present once everyone had gone" << std::endl;
+        failures++;
+    }
+
+    LOGDAT << (failures ? "FAILED" : "PASSED") << std::endl;
+    return failures ? 1 : 0;
+}
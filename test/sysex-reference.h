@@ -0,0 +1,164 @@
+/*
+ * A reference decoder for MIDI Tuning Standard SysEx, written from the standard rather than
+ * from the client's byte at a time state machine, so the two can be tested against each
+ * other. It splits a buffer into messages first and then decodes each one whole.
+ *
+ * The behaviour it pins down, which the client parser must share:
+ *
+ * - A message runs from F0 to F7, or to the next F0, or to the end of the buffer. Other
+ *   status bytes inside a message (real time clocks and the like) are skipped. Nothing
+ *   carries over between buffers.
+ * - Every format is accepted as real time (7F) or not (7E), from any device id.
+ * - Each tuning entry is applied as soon as it is complete, so a truncated message applies
+ *   the entries before the cut. Checksums are not checked.
+ * - A name is only taken once all 16 of its bytes have arrived.
+ * - An entry is a semitone plus a fraction in 1/16384ths, as the standard has it, and
+ *   7F 7F 7F means leave that note alone. Dump requests change nothing.
+ * - Scale/octave messages retune every octave of each pitch class. Formats 8 and 9 do so
+ *   on the channels in their bitmap, and every other format on every channel.
+ */
+
+#ifndef MTSREF_SYSEX_REFERENCE_H
+#define MTSREF_SYSEX_REFERENCE_H
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+struct ReferenceSysexTuning
+{
+    double retuning[16][128];
+    char name[17];
+
+    ReferenceSysexTuning()
+    {
+        for (auto &table : retuning)
+            for (int i = 0; i < 128; ++i)
+                table[i] = 440. * pow(2., (i - 69.) / 12.);
+        memset(name, 0, sizeof(name));
+        strcpy(name, "12-TET");
+    }
+
+    void decode(const unsigned char *buffer, int len)
+    {
+        std::vector<unsigned char> message;
+        bool inMessage{false};
+        for (int i = 0; i < len; ++i)
+        {
+            auto b = buffer[i];
+            if (b == 0xF0 || b == 0xF7)
+            {
+                if (inMessage)
+                    decodeMessage(message.data(), message.size());
+                message.clear();
+                inMessage = b == 0xF0;
+            }
+            else if (b < 0x80 && inMessage)
+            {
+                message.push_back(b);
+            }
+        }
+        if (inMessage)
+            decodeMessage(message.data(), message.size());
+    }
+
+  private:
+    // The client uses its own exp2, so compare the results with a tolerance
+    void retune(int note, int retuneNote, double detune, int channels = 0xFFFF)
+    {
+        auto f = 440. * pow(2., ((retuneNote + detune) - 69.) / 12.);
+        for (int ch = 0; ch < 16; ++ch)
+            if (channels & (1 << ch))
+                retuning[ch][note] = f;
+    }
+
+    void entry(int note, const unsigned char *xyz)
+    {
+        if (xyz[0] == 0x7F && xyz[1] == 0x7F && xyz[2] == 0x7F)
+            return;
+        retune(note, xyz[0], ((xyz[1] << 7) | xyz[2]) / 16384.);
+    }
+
+    bool takeName(const unsigned char *p, size_t n, size_t &i)
+    {
+        if (i + 16 > n)
+            return false;
+        memcpy(name, p + i, 16);
+        name[16] = 0;
+        i += 16;
+        return true;
+    }
+
+    void octave(const unsigned char *p, size_t n, size_t i, bool twoByte, int channels)
+    {
+        for (int pc = 0; pc < 12; ++pc)
+        {
+            double detune;
+            if (twoByte)
+            {
+                if (i + 2 > n)
+                    return;
+                int v = (p[i] << 7) | p[i + 1];
+                detune = (v - 8192.) / (v > 8192 ? 8191. : 8192.);
+                i += 2;
+            }
+            else
+            {
+                if (i + 1 > n)
+                    return;
+                detune = (p[i] - 64.) * 0.01;
+                i += 1;
+            }
+            for (int note = pc; note < 128; note += 12)
+                retune(note, note, detune, channels);
+        }
+    }
+
+    // p starts after the F0: universal id, device id, 08, format, then the body
+    void decodeMessage(const unsigned char *p, size_t n)
+    {
+        if (n < 4 || (p[0] != 0x7E && p[0] != 0x7F) || p[2] != 0x08)
+            return;
+
+        auto format = p[3];
+        size_t i = 4;
+        switch (format)
+        {
+        case 1: // bulk dump: program, name, 128 entries, checksum
+        case 4: // the same with a bank first
+            i += format == 4 ? 2 : 1;
+            if (!takeName(p, n, i))
+                return;
+            for (int note = 0; note < 128 && i + 3 <= n; ++note, i += 3)
+                entry(note, p + i);
+            break;
+        case 2: // single note changes: program, count, then key and entry for each
+        case 7: // the same with a bank first
+        {
+            i += format == 7 ? 2 : 1;
+            if (i >= n)
+                return;
+            int count = p[i++];
+            for (int k = 0; k < count && i + 4 <= n; ++k, i += 4)
+                entry(p[i], p + i + 1);
+            break;
+        }
+        case 5: // scale/octave dump, bank, program, name, 12 one or two byte values
+        case 6:
+            i += 2;
+            if (!takeName(p, n, i))
+                return;
+            octave(p, n, i, format == 6, 0xFFFF);
+            break;
+        case 8: // scale/octave tuning: channels 15-16, 8-14 and 1-7 as a bitmap, 12 values
+        case 9:
+            if (n >= 7)
+                octave(p, n, 7, format == 9, (p[4] & 3) << 14 | p[5] << 7 | p[6]);
+            break;
+        default: // dump requests and anything unknown
+            break;
+        }
+    }
+};
+
+#endif // MTSREF_SYSEX_REFERENCE_H
@@ -5,6 +5,14 @@
 #include "libMTSMaster.h"
 #include <iostream>
 #include <string.h>
+#include <stdlib.h>
+
+#if TEST_IPC_SUPPORT
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 
@@ -52,6 +60,63 @@ int masterTestCan()
     return 0;
 }
 
+#if TEST_IPC_SUPPORT
+/*
+ * Plant a segment under the library's key which can't be ours and make sure
+ * registering refuses to attach to it rather than treating it as tuning data.
+ */
+int mismatchedSegment()
+{
+    auto backend = getenv("MTS_REFERENCE_IPC_BACKEND");
+    bool sysv = backend && strcmp(backend, "sysv") == 0;
+    auto shmName = getenv("MTS_REFERENCE_SHM_NAME") ? getenv("MTS_REFERENCE_SHM_NAME")
+                                                     : "/mts-esp-reference";
+
+    int id{-1};
+    void *mem{nullptr};
+    if (sysv)
+    {
+        id = shmget(ftok(getenv("MTS_LIB_LOCATION"), 63), 64, 0666 | IPC_CREAT | IPC_EXCL);
+        mem = id < 0 ? nullptr : shmat(id, nullptr, 0);
+    }
+    else
+    {
+        id = shm_open(shmName, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (id >= 0 && ftruncate(id, 64) == 0)
+            mem = mmap(nullptr, 64, PROT_READ | PROT_WRITE, MAP_SHARED, id, 0);
+    }
+    if (!mem || mem == (void *)-1)
+    {
+        std::cout << "ERROR Unable to create a stand-in segment; is one already live?" << std::endl;
+        return 2;
+    }
+    memset(mem, 0x5a, 64);
+
+    MTS_RegisterMaster();
+    auto nc = MTS_GetNumClients();
+    MTS_DeregisterMaster();
+
+    if (sysv)
+    {
+        shmdt(mem);
+        shmctl(id, IPC_RMID, nullptr);
+    }
+    else
+    {
+        munmap(mem, 64);
+        close(id);
+        shm_unlink(shmName);
+    }
+
+    if (nc != -1)
+    {
+        std::cout << "ERROR Attached to a mismatched segment, client count " << nc << std::endl;
+        return 3;
+    }
+    return 0;
+}
+#endif
+
 int invalidCallSequence()
 {
     MTS_GetNumClients();
@@ -77,6 +142,9 @@ int main(int argc, char **argv)
     RUN(masterTestCan);
     RUN(masterTwice);
     RUN(invalidCallSequence);
+#if TEST_IPC_SUPPORT
+    RUN(mismatchedSegment);
+#endif
 
     std::cout << "********* UNABLE to LOCATE TEST " << argv[1] << std::endl;
 
@@ -4,8 +4,21 @@
 
 #include <iostream>
 #include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
 #include "libMTSMaster.h"
 #include "libMTSClient.h"
+#include "mtsref-extensions.h"
+
+#if UNIX_LIKE
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 #define LOGDAT                                                                                     \
     std::cout << "test/test-lib.cpp"                                                               \
@@ -103,6 +116,1286 @@ int clientMasterTest()
     return 0;
 }
 
+int snapshotTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_GetMultiChannelTuningTableSnapshot_fn || !ext.MTS_GetTuningTableSnapshot_fn ||
+        !ext.MTS_GetAllChannelsTuningTableSnapshot_fn)
+    {
+        LOGDAT << "Snapshot extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    MTS_SetMultiChannelNoteTuning(880.0, 69, 3);
+    double table[128];
+    if (!ext.MTS_GetMultiChannelTuningTableSnapshot_fn(table, 3) || table[69] != 880.0 ||
+        table[57] != 220.0)
+    {
+        LOGDAT << "Snapshot mismatch " << table[69] << " " << table[57] << std::endl;
+        return 2;
+    }
+    if (!ext.MTS_GetTuningTableSnapshot_fn(table) || table[69] != 440.0)
+    {
+        LOGDAT << "Channel 0 snapshot mismatch " << table[69] << std::endl;
+        return 3;
+    }
+
+    // A writer rewrites whole channels with a single value while we read. Every
+    // snapshot we manage to take must be uniform, or we saw a torn table.
+    double d[128];
+    for (auto &f : d)
+        f = 100.0;
+    MTS_SetNoteTunings(d);
+
+    std::atomic<bool> done{false};
+    std::thread writer([&done]() {
+        double d[128];
+        for (int v = 0; v < 20000; ++v)
+        {
+            for (auto &f : d)
+                f = 100.0 + (v % 7);
+            MTS_SetMultiChannelNoteTunings(d, v % 16);
+        }
+        done = true;
+    });
+
+    int torn{0}, taken{0};
+    double all[16 * 128];
+    while (!done)
+    {
+        if (ext.MTS_GetAllChannelsTuningTableSnapshot_fn(all))
+        {
+            taken++;
+            for (int ch = 0; ch < 16; ++ch)
+                for (int i = 1; i < 128; ++i)
+                    if (all[ch * 128 + i] != all[ch * 128])
+                        torn++;
+        }
+    }
+    writer.join();
+
+    LOGDAT << "Took " << taken << " snapshots with " << torn << " torn entries" << std::endl;
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+
+    return torn == 0 ? 0 : 4;
+}
+
+int generationTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_GetTuningGeneration_fn || !ext.MTS_GetDirtyNotes_fn)
+    {
+        LOGDAT << "Generation extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    auto g0 = ext.MTS_GetTuningGeneration_fn(3);
+    uint64_t mask[2];
+
+    // rewriting the same value isn't a change
+    MTS_SetMultiChannelNoteTuning(MTS_NoteToFrequency(cl, 69, 3), 69, 3);
+    if (ext.MTS_GetTuningGeneration_fn(3) != g0)
+    {
+        LOGDAT << "Generation moved without a change" << std::endl;
+        return 2;
+    }
+
+    MTS_SetMultiChannelNoteTuning(880.0, 69, 3);
+    auto g1 = ext.MTS_GetDirtyNotes_fn(3, g0, mask);
+    if (g1 <= g0 || mask[0] != 0 || mask[1] != (1ULL << (69 - 64)))
+    {
+        LOGDAT << "Bad dirty mask " << std::hex << mask[0] << " " << mask[1] << std::endl;
+        return 3;
+    }
+    if (ext.MTS_GetTuningGeneration_fn(4) >= g1)
+    {
+        LOGDAT << "Channel 4 moved with a channel 3 change" << std::endl;
+        return 4;
+    }
+
+    // filtering is a change too, on the channels it touches
+    MTS_FilterNote(true, 61, 3);
+    auto g2 = ext.MTS_GetDirtyNotes_fn(3, g1, mask);
+    if (g2 <= g1 || mask[0] != (1ULL << 61) || mask[1] != 0)
+    {
+        LOGDAT << "Bad filter dirty mask " << std::hex << mask[0] << " " << mask[1] << std::endl;
+        return 5;
+    }
+    auto g4 = ext.MTS_GetTuningGeneration_fn(4);
+    MTS_SetNoteTuning(432.0, 2);
+    ext.MTS_GetDirtyNotes_fn(4, g4, mask);
+    if (mask[0] != (1ULL << 2) || mask[1] != 0)
+    {
+        LOGDAT << "Bad all channel dirty mask " << std::hex << mask[0] << std::endl;
+        return 6;
+    }
+
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+/*
+ * The batched client calls must agree with the single note calls, including on
+ * unknown and out of range channels, and must see retunes made between batches.
+ */
+int batchTest()
+{
+    static constexpr int n = 300;
+    char notes[n], chans[n];
+    double batch[n];
+    for (int i = 0; i < n; ++i)
+    {
+        notes[i] = (i * 37) % 128;
+        chans[i] = (i % 19) - 1; // -1 through 17
+    }
+
+    auto check = [&](MTSClient *cl, const char *chs, const char *what) {
+        MTS_NotesToFrequencies(cl, notes, chs, batch, n);
+        for (int i = 0; i < n; ++i)
+            if (batch[i] != MTS_NoteToFrequency(cl, notes[i], chs ? chs[i] : -1))
+            {
+                LOGDAT << what << ": frequency mismatch at " << i << std::endl;
+                return false;
+            }
+        MTS_NotesToRatios(cl, notes, chs, batch, n);
+        for (int i = 0; i < n; ++i)
+            if (batch[i] != MTS_RetuningAsRatio(cl, notes[i], chs ? chs[i] : -1))
+            {
+                LOGDAT << what << ": ratio mismatch at " << i << std::endl;
+                return false;
+            }
+        MTS_NotesToSemitones(cl, notes, chs, batch, n);
+        for (int i = 0; i < n; ++i)
+            if (fabs(batch[i] - MTS_RetuningInSemitones(cl, notes[i], chs ? chs[i] : -1)) > 1e-9)
+            {
+                LOGDAT << what << ": semitone mismatch at " << i << std::endl;
+                return false;
+            }
+        return true;
+    };
+
+    auto cl = MTS_RegisterClient();
+    if (!check(cl, chans, "no master"))
+        return 1;
+
+    MTS_RegisterMaster();
+    if (!check(cl, chans, "12-TET"))
+        return 2;
+
+    MTS_SetNoteTuning(432.0, 69);
+    MTS_SetMultiChannelNoteTuning(500.0, 69, 3);
+    MTS_SetMultiChannel(true, 3);
+    if (!check(cl, chans, "multi channel") || !check(cl, nullptr, "no channels"))
+        return 3;
+
+    // a retune between batches has to reach the cached semitones
+    MTS_SetMultiChannelNoteTuning(510.0, 69, 3);
+    MTS_SetNoteTuning(420.0, 69);
+    if (!check(cl, chans, "retuned"))
+        return 4;
+
+    MTS_DeregisterMaster();
+    MTS_DeregisterClient(cl);
+    return 0;
+}
+
+int derivedTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_GetRatioTable_fn || !ext.MTS_GetSemitoneTable_fn ||
+        !ext.MTS_GetLog2FrequencyTable_fn || !ext.MTS_GetMultiChannelTuningTableFloat_fn)
+    {
+        LOGDAT << "Derived table extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    auto check = [&](int ch, const char *what) {
+        auto r = ext.MTS_GetRatioTable_fn(ch);
+        auto s = ext.MTS_GetSemitoneTable_fn(ch);
+        auto l = ext.MTS_GetLog2FrequencyTable_fn(ch);
+        for (int i = 0; i < 128; ++i)
+        {
+            auto f = MTS_NoteToFrequency(cl, i, ch);
+            auto et = 440.0 * pow(2.0, (i - 69.0) / 12.0);
+            if (fabs(r[i] - f / et) > 1e-12 || fabs(s[i] - 12 * log2(f / et)) > 1e-9 ||
+                fabs(l[i] - log2(f)) > 1e-12)
+            {
+                LOGDAT << what << ": bad derived value on channel " << ch << " note " << i
+                       << " ratio=" << r[i] << " semis=" << s[i] << " log2=" << l[i] << std::endl;
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (!check(0, "12-TET") || fabs(ext.MTS_GetSemitoneTable_fn(0)[60]) > 1e-9)
+        return 2;
+
+    MTS_SetNoteTuning(450.0, 69);
+    MTS_SetMultiChannelNoteTuning(220.0, 70, 5);
+    for (int ch = 0; ch < 16; ++ch)
+        if (!check(ch, "retuned"))
+            return 3;
+    if (ext.MTS_GetRatioTable_fn(-1) != ext.MTS_GetRatioTable_fn(0))
+        return 4;
+
+    MTS_Reinitialize();
+    if (!check(5, "reinitialized") || fabs(ext.MTS_GetRatioTable_fn(5)[70] - 1.0) > 1e-12)
+        return 5;
+
+    // and the float mirrors track the tables
+    MTS_RegisterMaster();
+    MTS_SetMultiChannelNoteTuning(123.456, 10, 9);
+    float ft[128];
+    auto f9 = ext.MTS_GetMultiChannelTuningTableFloat_fn(9);
+    if (!f9 || ((uintptr_t)f9 & 63) ||
+        ext.MTS_GetTuningTableFloat_fn() != ext.MTS_GetMultiChannelTuningTableFloat_fn(-1) ||
+        !ext.MTS_GetMultiChannelTuningTableSnapshotFloat_fn(ft, 9))
+        return 6;
+    for (int i = 0; i < 128; ++i)
+        if (f9[i] != (float)MTS_NoteToFrequency(cl, i, 9) || ft[i] != f9[i])
+        {
+            LOGDAT << "Float table differs at " << i << std::endl;
+            return 7;
+        }
+
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+/*
+ * The linear search the client shim used before the library kept an index. keys are
+ * channel << 7 | note, in the order the shim visited them.
+ */
+static int scanNearest(double freq, const double *freqs, const int *keys, int n)
+{
+    int iLower = -1, iUpper = -1;
+    for (int i = 0; i < n; ++i)
+    {
+        double d = freqs[i] - freq;
+        if (d == 0.)
+            return keys[i];
+        if (d < 0 && (iLower < 0 || freqs[i] > freqs[iLower]))
+            iLower = i;
+        else if (d > 0 && (iUpper < 0 || freqs[i] < freqs[iUpper]))
+            iUpper = i;
+    }
+    if (iLower < 0)
+        return iUpper < 0 ? 0 : keys[iUpper];
+    if (iUpper < 0)
+        return keys[iLower];
+    const double ln2 = 0.693147180559945309417;
+    double fmid = freqs[iLower] * pow(2., 0.5 * (log(freqs[iUpper] / freqs[iLower]) / ln2));
+    return freq < fmid ? keys[iLower] : keys[iUpper];
+}
+
+// Compares the index lookups for random frequencies with scanNearest over the current tuning
+static int checkNearest(MTSClient *cl, int queries)
+{
+    auto &ext = mtsref();
+    static double all[16 * 128];
+    ext.MTS_GetAllChannelsTuningTableSnapshot_fn(all);
+
+    double freqs[16 * 128];
+    int keys[16 * 128];
+    for (int q = 0; q < queries; ++q)
+    {
+        double f = 10.0 * pow(2.0, (rand() % 11000) / 1000.0);
+
+        for (int ch = -1; ch < 16; ++ch)
+        {
+            int n = 0, src = ch < 0 ? 0 : ch;
+            for (int i = 0; i < 128; ++i)
+                if (!MTS_ShouldFilterNote(cl, i, ch))
+                {
+                    freqs[n] = all[src * 128 + i];
+                    keys[n++] = i;
+                }
+            int expected = scanNearest(f, freqs, keys, n);
+            int got = ext.MTS_FindNearestNote_fn(f, ch);
+            if (got != expected)
+            {
+                LOGDAT << "f=" << f << " ch=" << ch << " got " << got << " expected " << expected
+                       << std::endl;
+                return 2;
+            }
+        }
+
+        int n = 0;
+        for (int ch = 0; ch < 16; ++ch)
+            for (int i = 0; i < 128; ++i)
+                if (!MTS_ShouldFilterNote(cl, i, ch))
+                {
+                    freqs[n] = all[ch * 128 + i];
+                    keys[n++] = (ch << 7) | i;
+                }
+        int expected = scanNearest(f, freqs, keys, n);
+        char gotCh;
+        int got = ext.MTS_FindNearestNoteAndChannel_fn(f, &gotCh);
+        if (got != (expected & 127) || gotCh != (expected >> 7))
+        {
+            LOGDAT << "f=" << f << " got " << got << "/" << (int)gotCh << " expected "
+                   << (expected & 127) << "/" << (expected >> 7) << std::endl;
+            return 3;
+        }
+    }
+    return 0;
+}
+
+int nearestTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_FindNearestNote_fn || !ext.MTS_FindNearestNoteAndChannel_fn ||
+        !ext.MTS_GetAllChannelsTuningTableSnapshot_fn)
+    {
+        LOGDAT << "Nearest note extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    // a jumbled tuning with repeated frequencies and some filtered notes
+    srand(42);
+    for (int ch = 0; ch < 16; ++ch)
+    {
+        double t[128];
+        for (int i = 0; i < 128; ++i)
+            t[i] = 20.0 * pow(2.0, (rand() % 1000) / 100.0);
+        MTS_SetMultiChannelNoteTunings(t, ch);
+    }
+    for (int i = 0; i < 100; ++i)
+        MTS_FilterNote(true, rand() % 128, (rand() % 17) - 1);
+    if (int r = checkNearest(cl, 2000))
+        return r;
+
+    // small writes, which patch the indexes rather than rebuild them, from a few frequencies
+    // so that channels and notes keep sounding the same ones
+    for (int round = 0; round < 300; ++round)
+    {
+        double f = 110.0 * pow(2.0, (rand() % 48) / 12.0);
+        switch (rand() % 5)
+        {
+        case 0:
+            MTS_SetNoteTuning(f, rand() % 128);
+            break;
+        case 1:
+            MTS_SetMultiChannelNoteTuning(f, rand() % 128, rand() % 16);
+            break;
+        case 2:
+        {
+            double t[128];
+            for (int i = 0; i < 128; ++i)
+                t[i] = 110.0 * pow(2.0, (rand() % 48) / 12.0);
+            if (rand() % 2)
+                MTS_SetNoteTunings(t);
+            else
+                MTS_SetMultiChannelNoteTunings(t, rand() % 16);
+            break;
+        }
+        case 3:
+            MTS_FilterNote(rand() % 2, rand() % 128, (rand() % 17) - 1);
+            break;
+        default:
+            if (rand() % 4 == 0)
+                MTS_ClearNoteFilter();
+            break;
+        }
+        if (int r = checkNearest(cl, 20))
+        {
+            LOGDAT << "after round " << round << std::endl;
+            return r;
+        }
+    }
+
+    // and the client API goes through the index
+    MTS_ClearNoteFilter();
+    MTS_SetNoteTuning(1000.0, 69);
+    if (MTS_FrequencyToNote(cl, 1001.0, 3) != 69)
+        return 4;
+
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int updateTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_BeginUpdate_fn || !ext.MTS_CommitUpdate_fn || !ext.MTS_CancelUpdate_fn)
+    {
+        LOGDAT << "Update extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    if (ext.MTS_CommitUpdate_fn())
+        return 2;
+    if (!ext.MTS_BeginUpdate_fn() || ext.MTS_BeginUpdate_fn())
+        return 3;
+
+    auto g3 = ext.MTS_GetTuningGeneration_fn(3);
+    auto c0 = ext.MTS_GetTuningChangeCount_fn();
+    double t[128];
+    for (int i = 0; i < 128; ++i)
+        t[i] = 100.0 + i;
+    MTS_SetMultiChannelNoteTunings(t, 3);
+    MTS_SetMultiChannelNoteTuning(555.0, 60, 7);
+    MTS_FilterNote(true, 61, 7);
+    MTS_SetScaleName("Staged");
+
+    // nothing is visible until the commit
+    if (MTS_NoteToFrequency(cl, 10, 3) == 110.0 || MTS_ShouldFilterNote(cl, 61, 7) ||
+        ext.MTS_GetTuningGeneration_fn(3) != g3 || ext.MTS_GetTuningChangeCount_fn() != c0 ||
+        strcmp(MTS_GetScaleName(cl), "Staged") == 0)
+    {
+        LOGDAT << "Staged update leaked out before commit" << std::endl;
+        return 4;
+    }
+
+    if (!ext.MTS_CommitUpdate_fn())
+        return 5;
+    auto g = ext.MTS_GetTuningGeneration_fn(3);
+    if (MTS_NoteToFrequency(cl, 10, 3) != 110.0 || MTS_NoteToFrequency(cl, 60, 7) != 555.0 ||
+        !MTS_ShouldFilterNote(cl, 61, 7) || strcmp(MTS_GetScaleName(cl), "Staged") != 0)
+    {
+        LOGDAT << "Commit did not publish the update" << std::endl;
+        return 6;
+    }
+    if (g == g3 || ext.MTS_GetTuningGeneration_fn(7) != g ||
+        ext.MTS_GetTuningChangeCount_fn() != c0 + 1)
+    {
+        LOGDAT << "Commit was not a single change" << std::endl;
+        return 7;
+    }
+
+    // a cancelled update changes nothing
+    ext.MTS_BeginUpdate_fn();
+    MTS_SetNoteTuning(1.0, 10);
+    ext.MTS_CancelUpdate_fn();
+    if (MTS_NoteToFrequency(cl, 10, 3) != 110.0 || ext.MTS_GetTuningGeneration_fn(3) != g)
+        return 8;
+
+    // and setters go straight through again
+    MTS_SetMultiChannelNoteTuning(120.0, 10, 3);
+    if (MTS_NoteToFrequency(cl, 10, 3) != 120.0)
+        return 9;
+
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int slotTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_CommitUpdateToSlot_fn || !ext.MTS_ActivateSlot_fn || !ext.MTS_GetActiveSlot_fn ||
+        !ext.MTS_GetSlotTuningTableSnapshot_fn || !ext.MTS_GetSlotName_fn ||
+        !ext.MTS_GetTuningChangeCount_fn)
+    {
+        LOGDAT << "Slot extensions not exported" << std::endl;
+        return 1;
+    }
+    if (ext.MTS_GetNumTuningSlots_fn() < 2)
+        return 2;
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    // fill two slots, neither of which is playing yet
+    for (int slot = 0; slot < 2; ++slot)
+    {
+        ext.MTS_BeginUpdate_fn();
+        MTS_SetNoteTuning(300.0 + slot, 69);
+        MTS_FilterNote(slot == 1, 70, -1);
+        MTS_SetScaleName(slot ? "Slot B" : "Slot A");
+        if (!ext.MTS_CommitUpdateToSlot_fn(slot))
+            return 3;
+    }
+    if (MTS_NoteToFrequency(cl, 69, 0) != 440.0 || ext.MTS_GetActiveSlot_fn() != -1)
+        return 4;
+
+    double t[128];
+    char name[32];
+    if (!ext.MTS_GetSlotTuningTableSnapshot_fn(1, t, 5) || t[69] != 301.0 ||
+        !ext.MTS_GetSlotName_fn(1, name, sizeof(name)) || strcmp(name, "Slot B") != 0)
+        return 5;
+
+    if (!ext.MTS_ActivateSlot_fn(1) || ext.MTS_GetActiveSlot_fn() != 1 ||
+        MTS_NoteToFrequency(cl, 69, 4) != 301.0 || !MTS_ShouldFilterNote(cl, 70, 2) ||
+        strcmp(MTS_GetScaleName(cl), "Slot B") != 0)
+    {
+        LOGDAT << "Slot 1 did not activate" << std::endl;
+        return 6;
+    }
+    if (!ext.MTS_ActivateSlot_fn(0) || MTS_NoteToFrequency(cl, 69, 4) != 300.0 ||
+        MTS_ShouldFilterNote(cl, 70, 2))
+        return 7;
+
+    // refilling the active slot is heard; retuning live leaves the slot
+    ext.MTS_BeginUpdate_fn();
+    MTS_SetNoteTuning(310.0, 69);
+    ext.MTS_CommitUpdateToSlot_fn(0);
+    if (MTS_NoteToFrequency(cl, 69, 4) != 310.0 || ext.MTS_GetActiveSlot_fn() != 0)
+        return 8;
+    MTS_SetNoteTuning(320.0, 69);
+    if (ext.MTS_GetActiveSlot_fn() != -1)
+        return 9;
+
+    if (ext.MTS_ActivateSlot_fn(ext.MTS_GetNumTuningSlots_fn()) || ext.MTS_ActivateSlot_fn(-1))
+        return 10;
+
+    // a bad slot changes nothing and leaves the update open for a good one
+    ext.MTS_BeginUpdate_fn();
+    MTS_SetNoteTuning(330.0, 69);
+    auto c0 = ext.MTS_GetTuningChangeCount_fn();
+    if (ext.MTS_CommitUpdateToSlot_fn(99) || ext.MTS_CommitUpdateToSlot_fn(-2) ||
+        ext.MTS_GetTuningChangeCount_fn() != c0)
+        return 11;
+    if (!ext.MTS_CommitUpdateToSlot_fn(1) || !ext.MTS_GetSlotTuningTableSnapshot_fn(1, t, 0) ||
+        t[69] != 330.0 || MTS_NoteToFrequency(cl, 69, 4) != 320.0)
+    {
+        LOGDAT << "The staged update didn't survive a bad slot" << std::endl;
+        return 12;
+    }
+
+    // a slot can't be activated under an open update, whose commit would undo it
+    ext.MTS_BeginUpdate_fn();
+    MTS_SetNoteTuning(340.0, 69);
+    if (ext.MTS_ActivateSlot_fn(1) || ext.MTS_GetActiveSlot_fn() != -1)
+        return 13;
+    if (!ext.MTS_CommitUpdate_fn() || MTS_NoteToFrequency(cl, 69, 4) != 340.0 ||
+        !ext.MTS_ActivateSlot_fn(1) || MTS_NoteToFrequency(cl, 69, 4) != 330.0)
+        return 14;
+
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int eventTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_ScheduleNoteTuning_fn || !ext.MTS_ApplyDueTuningEvents_fn ||
+        !ext.MTS_GetTuningEvents_fn || !ext.MTS_GetMonotonicTimeNs_fn)
+    {
+        LOGDAT << "Event extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    MTS_Reinitialize();
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    // scheduled out of order, in sample time
+    ext.MTS_ScheduleNoteTuning_fn(450.0, 69, -1, 1300);
+    ext.MTS_ScheduleNoteTuning_fn(460.0, 69, 2, 1100);
+    ext.MTS_ScheduleNoteTuning_fn(470.0, 70, 2, 2000);
+
+    MTSTuningEvent ev[8];
+    int n = ext.MTS_GetTuningEvents_fn(1024, 1536, ev, 8);
+    if (n != 2 || ev[0].time != 1100 || ev[0].midichannel != 2 || ev[1].time != 1300 ||
+        ev[1].midichannel != -1 || ev[1].freq != 450.0)
+    {
+        LOGDAT << "Wrong events in block: " << n << std::endl;
+        return 2;
+    }
+    if (ext.MTS_GetTuningEvents_fn(1024, 1536, ev, 1) != 1 || ev[0].time != 1100)
+        return 3;
+
+    // nothing is live until the master applies it, and then in time order
+    if (MTS_NoteToFrequency(cl, 69, 2) != 440.0)
+        return 4;
+    if (ext.MTS_ApplyDueTuningEvents_fn(1536) != 2 || ext.MTS_ApplyDueTuningEvents_fn(1536) != 0)
+        return 5;
+    if (MTS_NoteToFrequency(cl, 69, 2) != 450.0 || MTS_NoteToFrequency(cl, 69, 7) != 450.0 ||
+        MTS_NoteToFrequency(cl, 70, 2) == 470.0)
+    {
+        LOGDAT << "Applied events are wrong" << std::endl;
+        return 6;
+    }
+
+    // a full ring of unapplied events refuses more until they are applied
+    int queued = 0;
+    while (queued < 10000 && ext.MTS_ScheduleNoteTuning_fn(500.0, 1, 0, 5000))
+        ++queued;
+    if (queued == 0 || queued == 10000)
+        return 7;
+    if (ext.MTS_ApplyDueTuningEvents_fn(~0ULL) != queued + 1)
+        return 8;
+    if (!ext.MTS_ScheduleNoteTuning_fn(510.0, 1, 0, 6000))
+        return 9;
+
+    auto t0 = ext.MTS_GetMonotonicTimeNs_fn();
+    if (ext.MTS_GetMonotonicTimeNs_fn() < t0)
+        return 10;
+
+    // reinitializing drops what is scheduled, for clients too, and frees the whole ring
+    ext.MTS_ScheduleNoteTuning_fn(520.0, 2, 0, 7000);
+    MTS_Reinitialize();
+    MTS_RegisterMaster();
+    if (ext.MTS_GetTuningEvents_fn(0, ~0ULL, ev, 8) != 0 ||
+        ext.MTS_ApplyDueTuningEvents_fn(~0ULL) != 0 || MTS_NoteToFrequency(cl, 1, 0) == 510.0)
+    {
+        LOGDAT << "Dropped events are still visible" << std::endl;
+        return 11;
+    }
+    int requeued = 0;
+    while (requeued < 10000 && ext.MTS_ScheduleNoteTuning_fn(500.0, 1, 0, 5000))
+        ++requeued;
+    if (requeued != queued + 1 || ext.MTS_ApplyDueTuningEvents_fn(~0ULL) != requeued)
+        return 12;
+
+    // events applied while an update is open sound now and survive cancelling or committing it
+    ext.MTS_ScheduleNoteTuning_fn(530.0, 3, 0, 8000);
+    ext.MTS_BeginUpdate_fn();
+    MTS_SetNoteTuning(540.0, 4);
+    if (ext.MTS_ApplyDueTuningEvents_fn(8000) != 1 || MTS_NoteToFrequency(cl, 3, 0) != 530.0)
+        return 13;
+    ext.MTS_CancelUpdate_fn();
+    if (MTS_NoteToFrequency(cl, 3, 0) != 530.0 || MTS_NoteToFrequency(cl, 4, 0) == 540.0)
+        return 14;
+    ext.MTS_ScheduleNoteTuning_fn(550.0, 5, 0, 9000);
+    ext.MTS_BeginUpdate_fn();
+    ext.MTS_ApplyDueTuningEvents_fn(9000);
+    ext.MTS_CommitUpdate_fn();
+    if (MTS_NoteToFrequency(cl, 5, 0) != 550.0)
+        return 15;
+
+    MTS_Reinitialize();
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+/*
+ * One thread reinitializes while another schedules and applies events. Both take the event
+ * and write locks, so this hangs if they disagree on the order.
+ */
+int eventReinitTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_ScheduleNoteTuning_fn || !ext.MTS_ApplyDueTuningEvents_fn)
+    {
+        LOGDAT << "Event extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    std::atomic<bool> done{false};
+    std::thread watchdog([&done]() {
+        for (int i = 0; i < 600 && !done; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!done)
+        {
+            LOGDAT << "Deadlocked" << std::endl;
+            std::abort();
+        }
+    });
+    std::thread reinit([]() {
+        for (int i = 0; i < 2000; ++i)
+        {
+            MTS_Reinitialize();
+            MTS_RegisterMaster();
+        }
+    });
+    for (uint64_t t = 0; t < 20000; ++t)
+    {
+        ext.MTS_ScheduleNoteTuning_fn(440.0 + t % 7, t % 128, -1, t);
+        ext.MTS_ApplyDueTuningEvents_fn(t);
+    }
+    reinit.join();
+    done = true;
+    watchdog.join();
+
+    MTS_Reinitialize();
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int transitionTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_CommitUpdateWithTransition_fn || !ext.MTS_GetTransitionFrequency_fn ||
+        !ext.MTS_GetTransitionTuningTable_fn)
+    {
+        LOGDAT << "Transition extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    MTS_Reinitialize();
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+    auto near = [](double a, double b) { return fabs(a - b) < 1e-9 * b; };
+
+    // an octave up on note 69, gliding from t=1000 to t=2000
+    ext.MTS_BeginUpdate_fn();
+    MTS_SetNoteTuning(880.0, 69);
+    ext.MTS_CommitUpdateWithTransition_fn(1000, 1000);
+
+    if (MTS_NoteToFrequency(cl, 69, 3) != 880.0)
+        return 2;
+    if (!near(ext.MTS_GetTransitionFrequency_fn(69, 3, 500), 440.0) ||
+        !near(ext.MTS_GetTransitionFrequency_fn(69, 3, 1500), 440.0 * sqrt(2.0)) ||
+        ext.MTS_GetTransitionFrequency_fn(69, 3, 2000) != 880.0)
+    {
+        LOGDAT << "Bad glide: " << ext.MTS_GetTransitionFrequency_fn(69, 3, 1500) << std::endl;
+        return 3;
+    }
+    // the curve is monotonic and eases in
+    double prev = 0;
+    for (uint64_t t = 1000; t <= 2000; t += 50)
+    {
+        auto f = ext.MTS_GetTransitionFrequency_fn(69, -1, t);
+        if (f < prev)
+            return 4;
+        prev = f;
+    }
+    if (ext.MTS_GetTransitionFrequency_fn(69, 3, 1100) - 440.0 > 0.05 * 440.0)
+        return 5;
+
+    double table[128];
+    if (!ext.MTS_GetTransitionTuningTable_fn(table, 3, 1250) ||
+        !near(table[69], ext.MTS_GetTransitionFrequency_fn(69, 3, 1250)) ||
+        !near(table[60], MTS_NoteToFrequency(cl, 60, 3)))
+        return 6;
+
+    // retargeting halfway starts from where the glide had got to
+    ext.MTS_BeginUpdate_fn();
+    MTS_SetNoteTuning(440.0, 69);
+    ext.MTS_CommitUpdateWithTransition_fn(1500, 1000);
+    if (!near(ext.MTS_GetTransitionFrequency_fn(69, 3, 1500), 440.0 * sqrt(2.0)) ||
+        ext.MTS_GetTransitionFrequency_fn(69, 3, 2500) != 440.0)
+        return 7;
+
+    MTS_Reinitialize();
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int filterMaskTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_GetNoteFilterMask_fn || !ext.MTS_GetNoteFilterBitmap_fn)
+    {
+        LOGDAT << "Filter mask extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    MTS_ClearNoteFilter();
+    srand(7);
+    for (int i = 0; i < 60; ++i)
+        MTS_FilterNote(true, rand() % 128, (rand() % 17) - 1);
+    MTS_FilterNote(false, 3, 4);
+
+    uint64_t bitmap[32], mask[2];
+    if (!ext.MTS_GetNoteFilterBitmap_fn(bitmap))
+        return 2;
+    for (int ch = -1; ch < 16; ++ch)
+    {
+        if (!ext.MTS_GetNoteFilterMask_fn(ch, mask))
+            return 3;
+        for (int i = 0; i < 128; ++i)
+        {
+            bool bit = (mask[i >> 6] >> (i & 63)) & 1;
+            if (bit != MTS_ShouldFilterNote(cl, i, ch) ||
+                (ch >= 0 && bit != (bool)((bitmap[ch * 2 + (i >> 6)] >> (i & 63)) & 1)))
+            {
+                LOGDAT << "Filter mask wrong at note " << i << " channel " << ch << std::endl;
+                return 4;
+            }
+        }
+    }
+
+    MTS_ClearNoteFilter();
+    ext.MTS_GetNoteFilterMask_fn(-1, mask);
+    if (mask[0] || mask[1])
+        return 5;
+
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int invalidIndexTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_GetAllChannelsTuningTableSnapshot_fn || !ext.MTS_GetNoteFilterBitmap_fn)
+    {
+        LOGDAT << "Snapshot extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+    MTS_ClearNoteFilter();
+
+    // channel 15 is a real channel
+    MTS_FilterNoteMultiChannel(true, 60, 15);
+    if (!MTS_ShouldFilterNote(cl, 60, 15) || MTS_ShouldFilterNote(cl, 60, 14))
+    {
+        LOGDAT << "Channel 15 filter not set" << std::endl;
+        return 2;
+    }
+
+    static double before[16 * 128], after[16 * 128];
+    uint64_t bmBefore[32], bmAfter[32];
+    if (!ext.MTS_GetAllChannelsTuningTableSnapshot_fn(before) ||
+        !ext.MTS_GetNoteFilterBitmap_fn(bmBefore))
+        return 3;
+
+    // none of these name a real note or channel so none may land anywhere
+    MTS_SetNoteTuning(1000.0, -60);
+    MTS_SetNoteTuning(1000.0, (char)200);
+    MTS_SetMultiChannelNoteTuning(1000.0, 60, 16);
+    MTS_SetMultiChannelNoteTuning(1000.0, 60, -1);
+    MTS_SetMultiChannelNoteTuning(1000.0, -1, 3);
+    double d[128];
+    for (int i = 0; i < 128; ++i)
+        d[i] = 1000.0;
+    MTS_SetMultiChannelNoteTunings(d, 16);
+    MTS_SetMultiChannelNoteTunings(d, 100);
+    MTS_FilterNote(true, -5, 3);
+    MTS_FilterNoteMultiChannel(true, 61, 16);
+    MTS_FilterNoteMultiChannel(true, 61, -1);
+    MTS_ClearNoteFilterMultiChannel(16);
+    MTS_ClearNoteFilterMultiChannel(-3);
+
+    if (!ext.MTS_GetAllChannelsTuningTableSnapshot_fn(after) ||
+        !ext.MTS_GetNoteFilterBitmap_fn(bmAfter))
+        return 4;
+    if (memcmp(before, after, sizeof(before)) || memcmp(bmBefore, bmAfter, sizeof(bmBefore)))
+    {
+        LOGDAT << "Invalid index changed the tuning" << std::endl;
+        return 5;
+    }
+
+    // reads with an invalid note or channel are answered from a valid one
+    for (int ch : {-7, 16, 100})
+    {
+        if (MTS_NoteToFrequency(cl, 69, ch) != MTS_NoteToFrequency(cl, 69, -1))
+            return 6;
+        MTS_ShouldFilterNote(cl, -1, ch);
+    }
+    MTS_NoteToFrequency(cl, -1, 3);
+
+    MTS_ClearNoteFilter();
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int sysexTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_SetTuningFromSysex_fn || !ext.MTS_GetTuningChangeCount_fn ||
+        !ext.MTS_BeginUpdate_fn || !ext.MTS_CommitUpdate_fn)
+    {
+        LOGDAT << "SysEx extension not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_Reinitialize();
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+    auto et = [](double semitones) { return 440. * pow(2., (semitones - 69.) / 12.); };
+    auto near = [](double a, double b) { return std::fabs(a - b) <= b * 1e-12; };
+
+    // a bulk dump of notes a quarter tone sharp, leaving note 5 alone
+    std::vector<uint8_t> m{0xF0, 0x7E, 0x00, 0x08, 0x01, 0x00};
+    const char *name = "Quarter sharp   ";
+    m.insert(m.end(), name, name + 16);
+    for (int i = 0; i < 128; ++i)
+    {
+        if (i == 5)
+            m.insert(m.end(), {0x7F, 0x7F, 0x7F});
+        else
+            m.insert(m.end(), {(uint8_t)i, 0x40, 0x00});
+    }
+    m.insert(m.end(), {0x00, 0xF7});
+    // then a real time single note change of note 60 and a clock byte for good measure
+    m.insert(m.end(), {0xF0, 0x7F, 0x00, 0x08, 0x02, 0x00, 0x01, 60, 62, 0xF8, 0x00, 0x00, 0xF7});
+    // and a dump request, which changes nothing
+    m.insert(m.end(), {0xF0, 0x7E, 0x00, 0x08, 0x00, 0x00, 0xF7});
+
+    auto c0 = ext.MTS_GetTuningChangeCount_fn();
+    if (ext.MTS_SetTuningFromSysex_fn(m.data(), (int)m.size()) != 2)
+        return 2;
+    if (ext.MTS_GetTuningChangeCount_fn() != c0 + 1)
+    {
+        LOGDAT << "SysEx buffer wasn't applied as one write" << std::endl;
+        return 3;
+    }
+    for (int ch = 0; ch < 16; ++ch)
+    {
+        for (int i = 0; i < 128; ++i)
+        {
+            auto want = i == 60 ? et(62) : i == 5 ? et(5) : et(i + 0.5);
+            if (!near(MTS_NoteToFrequency(cl, i, ch), want))
+            {
+                LOGDAT << "Bulk dump wrong at note " << i << " channel " << ch << std::endl;
+                return 4;
+            }
+        }
+    }
+    if (strcmp(MTS_GetScaleName(cl), "Quarter sharp   ") != 0)
+        return 5;
+
+    // a scale/octave tuning for channels 1 and 16 only, 20 cents flat
+    std::vector<uint8_t> oct{0xF0, 0x7F, 0x00, 0x08, 0x08, 0x02, 0x00, 0x01};
+    for (int pc = 0; pc < 12; ++pc)
+        oct.push_back(64 - 20);
+    oct.push_back(0xF7);
+    if (ext.MTS_SetTuningFromSysex_fn(oct.data(), (int)oct.size()) != 1)
+        return 6;
+    for (int ch = 0; ch < 16; ++ch)
+    {
+        auto want = ch == 0 || ch == 15 ? et(67 - 0.2) : et(67.5);
+        if (!near(MTS_NoteToFrequency(cl, 67, ch), want))
+        {
+            LOGDAT << "Scale/octave tuning wrong on channel " << ch << std::endl;
+            return 7;
+        }
+    }
+
+    // inside an update nothing shows until the commit
+    oct[4] = 0x09;
+    oct.resize(8);
+    for (int pc = 0; pc < 12; ++pc)
+        oct.insert(oct.end(), {0x20, 0x00}); // half a semitone flat
+    oct.push_back(0xF7);
+    if (!ext.MTS_BeginUpdate_fn())
+        return 8;
+    ext.MTS_SetTuningFromSysex_fn(oct.data(), (int)oct.size());
+    if (!near(MTS_NoteToFrequency(cl, 67, 0), et(67 - 0.2)))
+        return 9;
+    if (!ext.MTS_CommitUpdate_fn() || !near(MTS_NoteToFrequency(cl, 67, 0), et(66.5)) ||
+        !near(MTS_NoteToFrequency(cl, 67, 3), et(67.5)))
+        return 10;
+
+    // nothing here is a tuning message
+    uint8_t junk[] = {0x90, 60, 100, 0xF0, 0x43, 0x10, 0x08, 0x01, 0xF7, 0xF0, 0x7E};
+    if (ext.MTS_SetTuningFromSysex_fn(junk, sizeof(junk)) != 0)
+        return 11;
+
+    MTS_Reinitialize();
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+
+    /*
+     * The client shim, parsing for itself with no master, reads the same bytes the same
+     * way. It decodes a bulk dump whole when its checksum is right and a byte at a time
+     * otherwise, so try both.
+     */
+    for (int goodChecksum = 0; goodChecksum < 2; ++goodChecksum)
+    {
+        std::vector<uint8_t> mixed{0xF0, 0x7E, 0x00, 0x08, 0x01, 0x00};
+        mixed.insert(mixed.end(), name, name + 16);
+        for (int i = 0; i < 128; ++i)
+        {
+            if (i == 9)
+                mixed.insert(mixed.end(), {0x7F, 0x7F, 0x7F});
+            else
+                mixed.insert(mixed.end(),
+                             {(uint8_t)i, (uint8_t)(i * 37 & 127), (uint8_t)(i * 91 & 127)});
+        }
+        uint8_t sum{0};
+        for (size_t i = 1; i < mixed.size(); ++i)
+            sum ^= mixed[i];
+        mixed.insert(mixed.end(), {(uint8_t)(goodChecksum ? sum : sum ^ 1), 0xF7});
+        mixed.insert(mixed.end(), {0xF0, 0x7F, 0x00, 0x08, 0x02, 0x00, 0x02, 60, 61, 0x7F, 0x7F,
+                                   61, 59, 0x00, 0x01, 0xF7});
+        mixed.insert(mixed.end(), {0xF0, 0x7E, 0x00, 0x08, 0x08, 0x00, 0x00, 0x0C});
+        for (int pc = 0; pc < 12; ++pc)
+            mixed.push_back((uint8_t)(pc * 11));
+        mixed.push_back(0xF7);
+        mixed.insert(mixed.end(), {0xF0, 0x7E, 0x00, 0x08, 0x09, 0x00, 0x00, 0x20});
+        for (int pc = 0; pc < 12; ++pc)
+            mixed.insert(mixed.end(), {(uint8_t)(pc * 10), (uint8_t)(pc * 29 & 127)});
+        mixed.push_back(0xF7);
+
+        MTS_RegisterMaster();
+        auto mcl = MTS_RegisterClient();
+        if (ext.MTS_SetTuningFromSysex_fn(mixed.data(), (int)mixed.size()) != 4)
+            return 12;
+        static double fromMaster[16][128];
+        for (int ch = 0; ch < 16; ++ch)
+            for (int i = 0; i < 128; ++i)
+                fromMaster[ch][i] = MTS_NoteToFrequency(mcl, i, ch);
+        MTS_Reinitialize();
+        MTS_DeregisterClient(mcl);
+        MTS_DeregisterMaster();
+
+        auto shim = MTS_RegisterClient();
+        if (MTS_HasMaster(shim))
+            return 13;
+        MTS_ParseMIDIDataU(shim, mixed.data(), (int)mixed.size());
+        for (int ch = 0; ch < 16; ++ch)
+        {
+            for (int i = 0; i < 128; ++i)
+            {
+                // the shim computes frequencies with a polynomial rather than pow
+                auto f = MTS_NoteToFrequency(shim, i, ch);
+                if (std::fabs(f - fromMaster[ch][i]) > fromMaster[ch][i] * 1e-14)
+                {
+                    LOGDAT << "Shim and library differ by " << f / fromMaster[ch][i] - 1
+                           << " at note " << i << " channel " << ch << std::endl;
+                    return 14;
+                }
+            }
+        }
+        MTS_DeregisterClient(shim);
+    }
+    return 0;
+}
+
+int octaveTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_SetOctaveTuning_fn || !ext.MTS_GetOctaveTuning_fn ||
+        !ext.MTS_SetTuningFromSysex_fn || !ext.MTS_BeginUpdate_fn ||
+        !ext.MTS_CommitUpdateToSlot_fn || !ext.MTS_ActivateSlot_fn)
+    {
+        LOGDAT << "Octave tuning extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_Reinitialize();
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+    auto et = [](double semitones) { return 440. * pow(2., (semitones - 69.) / 12.); };
+    auto near = [](double a, double b) { return std::fabs(a - b) <= b * 1e-12; };
+
+    // 12-TET reads back as an octave tuning on every channel
+    double cents[12], period;
+    for (int ch = -1; ch < 16; ++ch)
+    {
+        if (!ext.MTS_GetOctaveTuning_fn(ch, cents, &period) || period != 1200. || cents[7] != 0)
+        {
+            LOGDAT << "12-TET isn't an octave tuning on channel " << ch << std::endl;
+            return 2;
+        }
+    }
+
+    // quarter comma meantone, approximately, stretched by 3 cents an octave on channels 2 and 9
+    double mt[12] = {0, -24, -7, 10, -14, 3, -21, -3, -27, -10, 7, -17};
+    if (!ext.MTS_SetOctaveTuning_fn((1 << 2) | (1 << 9), mt, 1203.) ||
+        ext.MTS_SetOctaveTuning_fn(0xFFFF, mt, 0.) || ext.MTS_SetOctaveTuning_fn(0xFFFF, mt, NAN))
+        return 3;
+    for (int i = 0; i < 128; ++i)
+    {
+        double want = et(i + mt[i % 12] / 100. + (i / 12 - 5) * 0.03);
+        if (!near(MTS_NoteToFrequency(cl, i, 2), want) ||
+            !near(MTS_NoteToFrequency(cl, i, 9), want) || MTS_NoteToFrequency(cl, i, 3) != et(i))
+        {
+            LOGDAT << "Octave tuning wrong at note " << i << std::endl;
+            return 4;
+        }
+    }
+    if (!ext.MTS_GetOctaveTuning_fn(9, cents, &period) || period != 1203. ||
+        memcmp(cents, mt, sizeof(mt)) != 0)
+        return 5;
+
+    // setting a note directly leaves the channel without an octave form
+    MTS_SetMultiChannelNoteTuning(500.0, 60, 2);
+    if (ext.MTS_GetOctaveTuning_fn(2, cents, &period) || !ext.MTS_GetOctaveTuning_fn(9, cents, &period))
+        return 6;
+
+    // the form goes through staged updates and slots with the tables
+    if (!ext.MTS_BeginUpdate_fn())
+        return 7;
+    ext.MTS_SetOctaveTuning_fn(1 << 4, mt, 1200.);
+    if (!ext.MTS_CommitUpdateToSlot_fn(0))
+        return 8;
+    MTS_SetMultiChannelNoteTuning(500.0, 60, 4);
+    if (!ext.MTS_ActivateSlot_fn(0) || !ext.MTS_GetOctaveTuning_fn(4, cents, &period) ||
+        !near(MTS_NoteToFrequency(cl, 61, 4), et(61 - 0.24)) ||
+        ext.MTS_GetOctaveTuning_fn(2, cents, &period))
+    {
+        LOGDAT << "Octave tuning lost going through a slot" << std::endl;
+        return 9;
+    }
+
+    // as do complete scale/octave SysEx messages, on the channels they name
+    std::vector<uint8_t> oct{0xF0, 0x7F, 0x00, 0x08, 0x08, 0x00, 0x00, 0x41};
+    for (int pc = 0; pc < 12; ++pc)
+        oct.push_back(64 + pc);
+    oct.push_back(0xF7);
+    ext.MTS_SetTuningFromSysex_fn(oct.data(), (int)oct.size());
+    if (!ext.MTS_GetOctaveTuning_fn(6, cents, &period) || cents[11] != 11. ||
+        !ext.MTS_GetOctaveTuning_fn(0, cents, &period) || cents[3] != 3. ||
+        ext.MTS_GetOctaveTuning_fn(2, cents, &period) || !near(MTS_NoteToFrequency(cl, 71, 6), et(71.11)))
+        return 10;
+
+    MTS_Reinitialize();
+    MTS_DeregisterClient(cl);
+    MTS_DeregisterMaster();
+    return 0;
+}
+
+int waitTest()
+{
+    auto &ext = mtsref();
+    if (!ext.MTS_GetTuningChangeCount_fn || !ext.MTS_WaitForTuningChange_fn)
+    {
+        LOGDAT << "Wait extensions not exported" << std::endl;
+        return 1;
+    }
+
+    MTS_RegisterMaster();
+    auto c0 = ext.MTS_GetTuningChangeCount_fn();
+
+    // nothing changes so this times out with the same count
+    auto start = std::chrono::steady_clock::now();
+    if (ext.MTS_WaitForTuningChange_fn(c0, 50) != c0)
+        return 2;
+    if (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(40))
+        return 3;
+
+    std::thread setter([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        MTS_SetNoteTuning(431.0, 69);
+    });
+    start = std::chrono::steady_clock::now();
+    auto c1 = ext.MTS_WaitForTuningChange_fn(c0, 5000);
+    auto waited = std::chrono::steady_clock::now() - start;
+    setter.join();
+
+    LOGDAT << "Woke after "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(waited).count() << "ms"
+           << std::endl;
+    MTS_DeregisterMaster();
+
+    if (c1 == c0 || waited > std::chrono::milliseconds(2500))
+        return 4;
+    return 0;
+}
+
+#if UNIX_LIKE
+/*
+ * A child process registers clients and exits without deregistering, as a crashing
+ * host would. Its clients must drop out of the count once it is gone.
+ */
+int crashedClientTest()
+{
+    if (!MTS_HasIPC())
+    {
+        LOGDAT << "IPC disabled; nothing to share with a child process" << std::endl;
+        return 0;
+    }
+
+    MTS_RegisterMaster();
+    auto cl = MTS_RegisterClient();
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return 1;
+
+    auto pid = fork();
+    if (pid == 0)
+    {
+        MTS_RegisterClient();
+        MTS_RegisterClient();
+        int n = MTS_GetNumClients();
+        write(fds[1], &n, sizeof(n));
+        _exit(0);
+    }
+
+    int inChild{0};
+    read(fds[0], &inChild, sizeof(inChild));
+    waitpid(pid, nullptr, 0);
+    auto afterExit = MTS_GetNumClients();
+
+    LOGDAT << "Clients with child " << inChild << " after child exit " << afterExit << std::endl;
+
+    MTS_DeregisterClient(cl);
+    auto afterDereg = MTS_GetNumClients();
+    MTS_DeregisterMaster();
+
+    if (inChild != 3)
+        return 2;
+    if (afterExit != 1)
+        return 3;
+    if (afterDereg != 0)
+        return 4;
+    return 0;
+}
+
+/*
+ * A child master is killed while it retunes as fast as it can, so it often dies holding
+ * the write lock. The parent must still be able to register and write, and read a
+ * consistent snapshot, rather than spin forever behind the dead writer.
+ */
+int crashedMasterTest()
+{
+    auto &ext = mtsref();
+    if (!MTS_HasIPC() || !ext.MTS_GetTuningTableSnapshot_fn)
+    {
+        LOGDAT << "IPC disabled; nothing to share with a child process" << std::endl;
+        return 0;
+    }
+
+    // a hang here is the failure, so don't wait for the CI timeout to say so
+    alarm(60);
+    MTS_RegisterMaster();
+    for (int round = 0; round < 20; ++round)
+    {
+        auto pid = fork();
+        if (pid == 0)
+        {
+            double a[128], b[128];
+            for (int i = 0; i < 128; ++i)
+            {
+                a[i] = 440. * pow(2., (i - 69.) / 12.);
+                b[i] = a[i] * 1.01;
+            }
+            for (int k = 0;; ++k)
+                MTS_SetNoteTunings(k & 1 ? a : b);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(2 + round % 5));
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        MTS_RegisterMaster();
+        MTS_SetNoteTuning(431.0 + round, 69);
+        double snap[128];
+        if (!ext.MTS_GetTuningTableSnapshot_fn(snap))
+        {
+            LOGDAT << "Snapshot still failing after round " << round << std::endl;
+            return 1;
+        }
+        if (snap[69] != 431.0 + round)
+            return 2;
+    }
+    alarm(0);
+
+    MTS_Reinitialize();
+    MTS_DeregisterMaster();
+    return 0;
+}
+#endif
+
 int invalidCallSequence()
 {
     MTS_GetNumClients();
@@ -132,6 +1425,25 @@ int main(int argc, char **argv)
     }
 
     RUN(clientTest);
+    RUN(snapshotTest);
+    RUN(generationTest);
+    RUN(waitTest);
+    RUN(batchTest);
+    RUN(derivedTest);
+    RUN(nearestTest);
+    RUN(updateTest);
+    RUN(slotTest);
+    RUN(eventTest);
+    RUN(eventReinitTest);
+    RUN(transitionTest);
+    RUN(filterMaskTest);
+    RUN(invalidIndexTest);
+    RUN(sysexTest);
+    RUN(octaveTest);
+#if UNIX_LIKE
+    RUN(crashedClientTest);
+    RUN(crashedMasterTest);
+#endif
     RUN(invalidCallSequence);
 
     std::cout << "********* UNABLE to LOCATE TEST " << argv[1] << std::endl;